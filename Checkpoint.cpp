@@ -0,0 +1,155 @@
+/*
+ * Checkpoint implementation
+ */
+
+/*
+ * File:   Checkpoint.cpp
+ */
+
+#include "Checkpoint.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::cerr;
+
+// Definition for uses by reference (std::min)
+const size_t CheckpointWriter::kBufferSize;
+
+CheckpointWriter::CheckpointWriter(const std::string &file_name_)
+: file_name(file_name_), fd(-1), offset(0) {
+  fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cerr << "ERROR: failed to create checkpoint file: " << file_name << "\n";
+    exit(2);
+  }
+  buffer.reserve(kBufferSize);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  if (fd >= 0) {
+    Finish();
+  }
+}
+
+void CheckpointWriter::PutString(const std::string &s) {
+  Put<uint32_t>(s.size());
+  PutBytes(s.data(), s.size());
+}
+
+void CheckpointWriter::PutBytes(const void *bytes, size_t count) {
+  const uint8_t *p = static_cast<const uint8_t*>(bytes);
+  offset += count;
+
+  // Large pieces (page contents) bypass the buffer once it is written
+  if (count >= kBufferSize) {
+    FlushBuffer();
+    while (count > 0) {
+      ssize_t written = write(fd, p, count);
+      if (written <= 0) {
+        cerr << "ERROR: failed writing checkpoint file: " << file_name << "\n";
+        exit(2);
+      }
+      p += written;
+      count -= written;
+    }
+    return;
+  }
+  if (buffer.size() + count > kBufferSize) {
+    FlushBuffer();
+  }
+  buffer.insert(buffer.end(), p, p + count);
+}
+
+void CheckpointWriter::Align(size_t alignment) {
+  static const uint8_t zeros[0x1000] = {};
+  size_t padding = (alignment - offset % alignment) % alignment;
+  while (padding > 0) {
+    size_t piece = std::min(padding, sizeof zeros);
+    PutBytes(zeros, piece);
+    padding -= piece;
+  }
+}
+
+void CheckpointWriter::Finish(void) {
+  FlushBuffer();
+  if (close(fd) != 0) {
+    cerr << "ERROR: failed writing checkpoint file: " << file_name << "\n";
+    exit(2);
+  }
+  fd = -1;
+}
+
+void CheckpointWriter::FlushBuffer(void) {
+  size_t done = 0;
+  while (done < buffer.size()) {
+    ssize_t written = write(fd, buffer.data() + done, buffer.size() - done);
+    if (written <= 0) {
+      cerr << "ERROR: failed writing checkpoint file: " << file_name << "\n";
+      exit(2);
+    }
+    done += written;
+  }
+  buffer.clear();
+}
+
+CheckpointReader::CheckpointReader(const std::string &file_name_)
+: file_name(file_name_), data(nullptr), size(0), offset(0) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    cerr << "ERROR: failed to open checkpoint file: " << file_name << "\n";
+    exit(2);
+  }
+
+  // Map and read in the whole file: all of it is used, once
+  size = file_stat.st_size;
+  if (size > 0) {
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                        fd, 0);
+    if (mapped == MAP_FAILED) {
+      cerr << "ERROR: failed to map checkpoint file: " << file_name << "\n";
+      exit(2);
+    }
+    data = static_cast<const uint8_t*>(mapped);
+  }
+  close(fd);
+}
+
+CheckpointReader::~CheckpointReader() {
+  if (data != nullptr) {
+    munmap(const_cast<uint8_t*>(data), size);
+  }
+}
+
+std::string CheckpointReader::GetString(void) {
+  uint32_t length = Get<uint32_t>();
+  const uint8_t *bytes = GetBytes(length);
+  return std::string(reinterpret_cast<const char*>(bytes), length);
+}
+
+const uint8_t *CheckpointReader::GetBytes(size_t count) {
+  if (count > size - offset) {
+    cerr << "ERROR: checkpoint file is truncated: " << file_name << "\n";
+    exit(2);
+  }
+  const uint8_t *bytes = data + offset;
+  offset += count;
+  return bytes;
+}
+
+void CheckpointReader::Align(size_t alignment) {
+  GetBytes((alignment - offset % alignment) % alignment);
+}
+
+void CheckpointReader::Mismatch(const std::string &what) const {
+  cerr << "ERROR: checkpoint file " << file_name
+       << " does not match this run: " << what << "\n";
+  exit(2);
+}
@@ -0,0 +1,168 @@
+/*
+ * Checkpoint - writer and reader of simulation snapshot files (see
+ * Scheduler::WriteCheckpoint and Scheduler::RestoreCheckpoint).
+ *
+ * A checkpoint file is a sequence of fixed width values in host byte order,
+ * written and read back in the same order by the objects whose state it
+ * holds; it is only meant to be read by the build which wrote it. Page
+ * contents are aligned to kPageSize in the file, so they can be used in
+ * place from the mapping. The writer buffers the file and writes it in
+ * large pieces; the reader maps the whole file at once and hands out
+ * pointers into the mapping, checking every read against the end of the
+ * file.
+ */
+
+/*
+ * File:   Checkpoint.h
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+class CheckpointWriter {
+public:
+  /**
+   * Constructor - create the checkpoint file. Reports an error to cerr and
+   *   exits if it can't be created.
+   *
+   * @param file_name_ file to create (replaced if it exists)
+   */
+  CheckpointWriter(const std::string &file_name_);
+
+  /**
+   * Destructor - write what is buffered and close the file
+   */
+  virtual ~CheckpointWriter();
+
+  // Disallow copy/move
+  CheckpointWriter(const CheckpointWriter &other) = delete;
+  CheckpointWriter(CheckpointWriter &&other) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &other) = delete;
+  CheckpointWriter &operator=(CheckpointWriter &&other) = delete;
+
+  /**
+   * Put - append a value of a trivially copyable type
+   */
+  template <typename T>
+  void Put(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "checkpoint values must be trivially copyable");
+    PutBytes(&value, sizeof value);
+  }
+
+  /**
+   * PutString - append a string, preceded by its length
+   */
+  void PutString(const std::string &s);
+
+  /**
+   * PutBytes - append bytes
+   */
+  void PutBytes(const void *bytes, size_t count);
+
+  /**
+   * Align - append zero bytes up to a multiple of alignment (a power of 2)
+   */
+  void Align(size_t alignment);
+
+  /**
+   * Finish - write what is buffered and close the file. Reports an error
+   *   to cerr and exits if the file can't be written.
+   */
+  void Finish(void);
+
+private:
+  std::string file_name;
+  int fd;  // -1 once finished
+  std::vector<uint8_t> buffer;
+  uint64_t offset;  // bytes appended so far
+
+  // Bytes buffered before writing to the file
+  static const size_t kBufferSize = 0x100000;
+
+  /**
+   * FlushBuffer - write the buffer to the file
+   */
+  void FlushBuffer(void);
+};
+
+class CheckpointReader {
+public:
+  /**
+   * Constructor - map a checkpoint file. Reports an error to cerr and exits
+   *   if it can't be opened.
+   *
+   * @param file_name_ file to read
+   */
+  CheckpointReader(const std::string &file_name_);
+
+  /**
+   * Destructor - unmap the file
+   */
+  virtual ~CheckpointReader();
+
+  // Disallow copy/move
+  CheckpointReader(const CheckpointReader &other) = delete;
+  CheckpointReader(CheckpointReader &&other) = delete;
+  CheckpointReader &operator=(const CheckpointReader &other) = delete;
+  CheckpointReader &operator=(CheckpointReader &&other) = delete;
+
+  /**
+   * Get - read a value written by CheckpointWriter::Put
+   */
+  template <typename T>
+  T Get(void) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "checkpoint values must be trivially copyable");
+    T value;
+    std::memcpy(&value, GetBytes(sizeof value), sizeof value);
+    return value;
+  }
+
+  /**
+   * GetString - read a string written by CheckpointWriter::PutString
+   */
+  std::string GetString(void);
+
+  /**
+   * GetBytes - read bytes. Reports an error to cerr and exits if the file
+   *   ends first.
+   *
+   * @param count number of bytes
+   * @return pointer to the bytes in the mapping, valid until destruction
+   */
+  const uint8_t *GetBytes(size_t count);
+
+  /**
+   * Align - skip to a multiple of alignment, as CheckpointWriter::Align
+   */
+  void Align(size_t alignment);
+
+  /**
+   * at_end - true if every byte of the file has been read
+   */
+  bool at_end(void) const { return offset == size; }
+
+  /**
+   * Mismatch - report that the checkpoint can't be restored in this run
+   *   to cerr and exit
+   *
+   * @param what the setting or value which differs
+   */
+  [[noreturn]] void Mismatch(const std::string &what) const;
+
+private:
+  std::string file_name;
+  const uint8_t *data;
+  size_t size;
+  size_t offset;  // of next byte to read
+};
+
+#endif /* CHECKPOINT_H */
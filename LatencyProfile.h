@@ -0,0 +1,155 @@
+/*
+ * LatencyProfile - latency histograms of the simulator's hot paths: each
+ * command handler (by command type, for each process), mapping a page,
+ * allocating page frames, and the scheduler's switch between time slices.
+ * They appear in the --stats report (see SimulatorStats.h).
+ *
+ * Profiling is compiled in only when SIM_LATENCY_PROFILING is defined to 1
+ * (e.g. -DSIM_LATENCY_PROFILING=1). Otherwise kLatencyProfiling is false,
+ * LatencyHistogram and LatencyTimer are the empty specializations below,
+ * and every use compiles to nothing: no clock reads and no storage beyond
+ * an empty member.
+ *
+ * Histograms are log-bucketed: bucket 0 counts latencies of 0 ns, and
+ * bucket b counts latencies from 2^(b-1) up to 2^b - 1 ns, so 40 buckets
+ * reach past 4 minutes with a relative error under 2. Recording costs two
+ * reads of the steady clock and a count-leading-zeros. Each histogram
+ * belongs to one process, allocator or worker, so updates need no locking.
+ */
+
+/*
+ * File:   LatencyProfile.h
+ */
+
+#ifndef LATENCYPROFILE_H
+#define LATENCYPROFILE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#ifndef SIM_LATENCY_PROFILING
+#define SIM_LATENCY_PROFILING 0
+#endif
+
+// True if latency histograms are compiled in
+constexpr bool kLatencyProfiling = SIM_LATENCY_PROFILING != 0;
+
+/**
+ * BasicLatencyHistogram - histogram of latencies in nanoseconds, or (when
+ *   not enabled) an empty stand-in
+ */
+template <bool kEnabled>
+class BasicLatencyHistogram {
+public:
+  static const unsigned kBuckets = 40;
+
+  /**
+   * Now - current steady clock time in nanoseconds
+   */
+  static uint64_t Now(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * Record - count one latency
+   */
+  void Record(uint64_t ns) {
+    unsigned bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+    ++buckets[std::min(bucket, kBuckets - 1)];
+    ++count;
+    total_ns += ns;
+    max_ns = std::max(max_ns, ns);
+  }
+
+  /**
+   * RecordSince - count the latency from a time returned by Now
+   */
+  void RecordSince(uint64_t start) { Record(Now() - start); }
+
+  /**
+   * Add - add the counts of another histogram
+   */
+  void Add(const BasicLatencyHistogram &other) {
+    for (unsigned b = 0; b < kBuckets; ++b) {
+      buckets[b] += other.buckets[b];
+    }
+    count += other.count;
+    total_ns += other.total_ns;
+    max_ns = std::max(max_ns, other.max_ns);
+  }
+
+  /**
+   * Percentile - upper bound of the bucket holding a quantile (the largest
+   *   latency recorded, for the last bucket used)
+   *
+   * @param q quantile, from 0 to 1
+   * @return latency in nanoseconds, 0 if nothing was recorded
+   */
+  uint64_t Percentile(double q) const {
+    uint64_t rank = static_cast<uint64_t>(q * count);
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < kBuckets; ++b) {
+      seen += buckets[b];
+      if ((seen > rank || seen == count) && b + 1 < kBuckets) {
+        uint64_t bound = b == 0 ? 0 : (uint64_t(1) << b) - 1;
+        return std::min(bound, max_ns);
+      }
+    }
+    return max_ns;
+  }
+
+  uint64_t buckets[kBuckets] = {};
+  uint64_t count = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+};
+
+template <>
+class BasicLatencyHistogram<false> {
+public:
+  static const unsigned kBuckets = 0;
+  // Constants in place of the counts, so reports compile either way
+  static constexpr uint64_t buckets[1] = {};
+  static constexpr uint64_t count = 0;
+  static constexpr uint64_t total_ns = 0;
+  static constexpr uint64_t max_ns = 0;
+  static uint64_t Now(void) { return 0; }
+  void Record(uint64_t) {}
+  void RecordSince(uint64_t) {}
+  void Add(const BasicLatencyHistogram &) {}
+  uint64_t Percentile(double) const { return 0; }
+};
+
+/**
+ * BasicLatencyTimer - records the lifetime of a scope in a histogram
+ */
+template <bool kEnabled>
+class BasicLatencyTimer {
+public:
+  explicit BasicLatencyTimer(BasicLatencyHistogram<kEnabled> &histogram_)
+  : histogram(histogram_), start(histogram_.Now()) {}
+  ~BasicLatencyTimer() { histogram.RecordSince(start); }
+
+  // Disallow copy/move
+  BasicLatencyTimer(const BasicLatencyTimer &other) = delete;
+  BasicLatencyTimer(BasicLatencyTimer &&other) = delete;
+  BasicLatencyTimer &operator=(const BasicLatencyTimer &other) = delete;
+  BasicLatencyTimer &operator=(BasicLatencyTimer &&other) = delete;
+
+private:
+  BasicLatencyHistogram<kEnabled> &histogram;
+  uint64_t start;
+};
+
+template <>
+class BasicLatencyTimer<false> {
+public:
+  explicit BasicLatencyTimer(BasicLatencyHistogram<false> &) {}
+};
+
+typedef BasicLatencyHistogram<kLatencyProfiling> LatencyHistogram;
+typedef BasicLatencyTimer<kLatencyProfiling> LatencyTimer;
+
+#endif /* LATENCYPROFILE_H */
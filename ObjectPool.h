@@ -0,0 +1,99 @@
+/*
+ * ObjectPool - pool of storage for objects of one type.
+ *
+ * Storage is allocated in chunks of objects, and the storage of destroyed
+ * objects is kept on a free list and reused by the next Create, so a
+ * scheduler starting and finishing many processes allocates from the heap
+ * only when more processes are alive at once than ever before. Storage is
+ * returned to the heap when the pool is destroyed; every object must have
+ * been destroyed first. A pool is used by one thread at a time.
+ */
+
+/*
+ * File:   ObjectPool.h
+ */
+
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class ObjectPool {
+public:
+  /**
+   * Constructor
+   *
+   * @param chunk_objects_ number of objects of storage allocated at a time
+   */
+  explicit ObjectPool(size_t chunk_objects_ = 64)
+  : chunk_objects(chunk_objects_), free_list(nullptr) {}
+  virtual ~ObjectPool() {}
+
+  // Disallow copy/move
+  ObjectPool(const ObjectPool &other) = delete;
+  ObjectPool(ObjectPool &&other) = delete;
+  ObjectPool &operator=(const ObjectPool &other) = delete;
+  ObjectPool &operator=(ObjectPool &&other) = delete;
+
+  /**
+   * Create - construct an object in pool storage
+   *
+   * @param args arguments of the constructor of T
+   * @return the object, to be destroyed with Destroy
+   */
+  template <typename... Args>
+  T *Create(Args &&... args) {
+    if (free_list == nullptr) {
+      Grow();
+    }
+    Slot *slot = free_list;
+    free_list = slot->next;
+    try {
+      return new (slot->storage) T(std::forward<Args>(args)...);
+    } catch (...) {
+      slot->next = free_list;
+      free_list = slot;
+      throw;
+    }
+  }
+
+  /**
+   * Destroy - destroy an object made by Create, keeping its storage
+   */
+  void Destroy(T *object) {
+    object->~T();
+    Slot *slot = reinterpret_cast<Slot*>(object);
+    slot->next = free_list;
+    free_list = slot;
+  }
+
+private:
+  // Storage of one object, or link in the free list while unused
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char storage[sizeof (T)];
+  };
+
+  size_t chunk_objects;
+  std::vector<std::unique_ptr<Slot[]>> chunks;
+  Slot *free_list;
+
+  /**
+   * Grow - allocate a chunk and put its slots on the free list
+   */
+  void Grow(void) {
+    chunks.emplace_back(new Slot[chunk_objects]);
+    Slot *chunk = chunks.back().get();
+    for (size_t i = chunk_objects; i-- > 0; ) {
+      chunk[i].next = free_list;
+      free_list = &chunk[i];
+    }
+  }
+};
+
+#endif /* OBJECTPOOL_H */
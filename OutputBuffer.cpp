@@ -0,0 +1,74 @@
+/*
+ * OutputBuffer implementation
+ */
+
+/*
+ * File:   OutputBuffer.cpp
+ */
+
+#include "OutputBuffer.h"
+
+namespace {
+const char kHexDigits[] = "0123456789abcdef";
+
+/*
+ * DumpTable - text of each byte value as written by dump (" 00".." ff")
+ */
+struct DumpTable {
+  char text[256][3];
+
+  DumpTable() {
+    for (int i = 0; i < 256; ++i) {
+      text[i][0] = ' ';
+      text[i][1] = kHexDigits[i >> 4];
+      text[i][2] = kHexDigits[i & 0xF];
+    }
+  }
+};
+
+const DumpTable dump_table;
+}
+
+void OutputBuffer::AppendDec(long long value) {
+  char digits[24];
+  char *p = digits + sizeof(digits);
+  unsigned long long magnitude = value < 0 ? 0ull - value : value;
+  do {
+    *--p = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (value < 0) {
+    *--p = '-';
+  }
+  data.append(p, digits + sizeof(digits) - p);
+}
+
+void OutputBuffer::AppendHex(uint32_t value) {
+  AppendHex(value, 1);
+}
+
+void OutputBuffer::AppendHex(uint32_t value, int width) {
+  char digits[8];
+  char *p = digits + sizeof(digits);
+  do {
+    *--p = kHexDigits[value & 0xF];
+    value >>= 4;
+  } while (value != 0);
+  for (int n = digits + sizeof(digits) - p; n < width; ++n) {
+    data.push_back('0');
+  }
+  data.append(p, digits + sizeof(digits) - p);
+}
+
+void OutputBuffer::AppendDumpBytes(const uint8_t *bytes, size_t count) {
+  size_t start = data.size();
+  data.resize(start + 3 * count);
+  char *out = &data[start];
+  for (size_t i = 0; i < count; ++i) {
+    const char *text = dump_table.text[bytes[i]];
+    out[0] = text[0];
+    out[1] = text[1];
+    out[2] = text[2];
+    out += 3;
+  }
+}
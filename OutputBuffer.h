@@ -0,0 +1,86 @@
+/*
+ * OutputBuffer - growable buffer of output text with hand-rolled number
+ * formatting.
+ *
+ * Each process formats its output into its own OutputBuffer; the scheduler
+ * hands the buffer to the OutputSink at the end of each time slice. The
+ * formatting functions produce exactly the text the equivalent iostream
+ * insertions produce (std::dec, std::hex, setw/setfill('0')), without any
+ * locale or stream state.
+ */
+
+/*
+ * File:   OutputBuffer.h
+ */
+
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+class OutputSink;
+
+class OutputBuffer {
+public:
+  OutputBuffer() {}
+  virtual ~OutputBuffer() {}
+
+  // Disallow copy/move
+  OutputBuffer(const OutputBuffer &other) = delete;
+  OutputBuffer(OutputBuffer &&other) = delete;
+  OutputBuffer &operator=(const OutputBuffer &other) = delete;
+  OutputBuffer &operator=(OutputBuffer &&other) = delete;
+
+  /**
+   * Append - append text
+   */
+  void Append(std::string_view text) { data.append(text.data(), text.size()); }
+  void Append(char c) { data.push_back(c); }
+
+  /**
+   * AppendDec - append a number in decimal
+   */
+  void AppendDec(long long value);
+
+  /**
+   * AppendHex - append a number in lower case hexadecimal, without leading 0s
+   *   (same as std::hex)
+   */
+  void AppendHex(uint32_t value);
+
+  /**
+   * AppendHex - append a number in lower case hexadecimal, padded with 0s to
+   *   at least width digits (same as std::hex, setw(width), setfill('0'))
+   */
+  void AppendHex(uint32_t value, int width);
+
+  /**
+   * AppendDumpBytes - append bytes as in the dump command: each byte as a
+   *   space followed by 2 hex digits
+   *
+   * @param bytes values to append
+   * @param count number of bytes
+   */
+  void AppendDumpBytes(const uint8_t *bytes, size_t count);
+
+  // Access to contents
+  bool empty(void) const { return data.empty(); }
+  size_t size(void) const { return data.size(); }
+  void clear(void) { data.clear(); }
+  
+  /**
+   * swap - exchange contents with another buffer without copying
+   */
+  void swap(OutputBuffer &other) { data.swap(other.data); }
+
+private:
+  std::string data;
+
+  // OutputSink takes over the contents without copying
+  friend class OutputSink;
+};
+
+#endif /* OUTPUTBUFFER_H */
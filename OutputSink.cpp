@@ -0,0 +1,97 @@
+/*
+ * OutputSink implementation
+ */
+
+/*
+ * File:   OutputSink.cpp
+ */
+
+#include "OutputSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+
+#include <limits.h>
+#include <sys/uio.h>
+
+using std::string;
+
+namespace {
+// Maximum number of spare strings kept for reuse
+const size_t kMaxSpare = 16;
+}
+
+OutputSink::OutputSink(int fd_, size_t flush_threshold_)
+: fd(fd_), flush_threshold(flush_threshold_), queued_bytes(0) {
+}
+
+OutputSink::~OutputSink() {
+  Flush();
+}
+
+void OutputSink::Write(OutputBuffer &buffer) {
+  if (buffer.empty()) {
+    return;
+  }
+  queued_bytes += buffer.size();
+
+  // Copy small output onto the end of the last queued string
+  if (!queued.empty() && buffer.size() < kCopyLimit) {
+    queued.back().append(buffer.data);
+    buffer.clear();
+    return;
+  }
+
+  // Otherwise take the buffer's string, giving it a spare one in exchange
+  queued.emplace_back();
+  queued.back().swap(buffer.data);
+  if (!spare.empty()) {
+    buffer.data.swap(spare.back());
+    spare.pop_back();
+  }
+}
+
+void OutputSink::Flush(void) {
+  size_t next = 0;  // next queued string to write
+  size_t written = 0;  // bytes of queued[next] already written
+  std::vector<struct iovec> iov;
+
+  while (next < queued.size()) {
+    // Gather as many strings as writev accepts
+    iov.clear();
+    for (size_t i = next; i < queued.size() && iov.size() < IOV_MAX; ++i) {
+      size_t skip = i == next ? written : 0;
+      iov.push_back({ const_cast<char*>(queued[i].data()) + skip,
+                      queued[i].size() - skip });
+    }
+
+    ssize_t result = writev(fd, iov.data(), iov.size());
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "ERROR: failed to write output\n";
+      break;
+    }
+
+    // Advance past what was written
+    size_t count = result;
+    while (next < queued.size() && count >= queued[next].size() - written) {
+      count -= queued[next].size() - written;
+      written = 0;
+      ++next;
+    }
+    written += count;
+  }
+
+  // Keep emptied strings for reuse
+  for (string &s : queued) {
+    if (spare.size() < kMaxSpare) {
+      s.clear();
+      spare.push_back(std::move(s));
+    }
+  }
+  queued.clear();
+  queued_bytes = 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * OutputSink - destination of all simulator output (standard output by
+ * default, or any file descriptor).
+ *
+ * Output buffers written to the sink are queued without copying (small
+ * buffers are coalesced) and written with writev when the queued output
+ * exceeds the flush threshold. The scheduler checks the threshold only at
+ * time slice boundaries, so output is never written in the middle of a
+ * time slice. Everything still queued is written by Flush and on
+ * destruction.
+ */
+
+/*
+ * File:   OutputSink.h
+ */
+
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+#include "OutputBuffer.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class OutputSink {
+public:
+  /**
+   * Constructor
+   *
+   * @param fd_ file descriptor to write output to
+   * @param flush_threshold_ number of queued bytes at which FlushIfFull
+   *   writes the output
+   */
+  OutputSink(int fd_ = 1, size_t flush_threshold_ = kDefaultFlushThreshold);
+
+  /**
+   * Destructor - write any queued output
+   */
+  virtual ~OutputSink();
+
+  // Disallow copy/move
+  OutputSink(const OutputSink &other) = delete;
+  OutputSink(OutputSink &&other) = delete;
+  OutputSink &operator=(const OutputSink &other) = delete;
+  OutputSink &operator=(OutputSink &&other) = delete;
+
+  /**
+   * Write - queue the contents of an output buffer. The buffer is left empty.
+   *
+   * @param buffer output to write
+   */
+  void Write(OutputBuffer &buffer);
+
+  /**
+   * FlushIfFull - write queued output if it exceeds the flush threshold
+   */
+  void FlushIfFull(void) {
+    if (queued_bytes >= flush_threshold) {
+      Flush();
+    }
+  }
+
+  /**
+   * Flush - write all queued output
+   */
+  void Flush(void);
+
+  static const size_t kDefaultFlushThreshold = 1 << 20;
+
+private:
+  int fd;
+  size_t flush_threshold;
+
+  // Output waiting to be written, and total size
+  std::vector<std::string> queued;
+  size_t queued_bytes;
+
+  // Emptied strings kept to be handed back to output buffers
+  std::vector<std::string> spare;
+
+  // Buffers smaller than this are copied onto the last queued string
+  static const size_t kCopyLimit = 4096;
+};
+
+#endif /* OUTPUTSINK_H */
@@ -8,68 +8,101 @@
 
 #include "PageFrameAllocator.h"
 
-#include <array>
-#include <cstring>
+#include <algorithm>
 #include <sstream>
 
 using mem::Addr;
 using mem::kPageSize;
 
+namespace {
+// Source for clearing page frames. Up to kClearFrames adjacent frames are
+// cleared with one write.
+const Addr kClearFrames = 16;
+uint8_t zero_frames[kClearFrames * kPageSize];
+}
+
+// Definitions for uses by reference (std::fill)
+const uint32_t PageFrameAllocator::kNoFrame;
+const unsigned PageFrameAllocator::kMaxOrder;
+
 PageFrameAllocator::PageFrameAllocator(mem::MMU &mmu) 
 : memory(mmu),
   page_frames_total(memory.get_frame_count()),
   page_frames_free(memory.get_frame_count()),
-  free_list_head(0)
+  high_water(0)
 {
-  // Add all page frames to free list
-  Addr last_page_addr = (page_frames_total - 1) * kPageSize;
-  for (Addr frame_addr = 0; frame_addr < last_page_addr; frame_addr += kPageSize) {
-    Addr next = frame_addr + kPageSize;
-    memory.put_bytes(frame_addr, sizeof(Addr), reinterpret_cast<uint8_t*>(&next));
-  }
-  
-  // Last page frame has end of list marker
-  Addr end_list = kEndList;
-  memory.put_bytes(last_page_addr, sizeof(Addr), 
-                   reinterpret_cast<uint8_t*>(&end_list));
+  std::fill(free_heads, free_heads + kMaxOrder + 1, kNoFrame);
+  std::fill(free_blocks, free_blocks + kMaxOrder + 1, 0);
 }
 
 bool PageFrameAllocator::Allocate(Addr count, 
-                                  std::vector<Addr> &page_frames) {
+                                  std::vector<Addr> &page_frames,
+                                  bool clear) {
+  LatencyTimer timer(stats.allocate_latency);
   if (count <= page_frames_free) {  // if enough to allocate
-    std::array<uint8_t, kPageSize> zero_page;  // page of all 0
-    zero_page.fill(0);
+    // Every free frame is in a block or above the high-water mark, so
+    // taking single frames can't fail
+    size_t first = page_frames.size();
+    for (Addr i = 0; i < count; ++i) {
+      uint32_t frame;
+      TakeBlock(0, frame);
+      page_frames.push_back(frame * kPageSize);
+    }
+    page_frames_free -= count;
+    stats.frames_allocated += count;
+    stats.frames_in_use += count;
+    stats.peak_frames_in_use = std::max(stats.peak_frames_in_use,
+                                        stats.frames_in_use);
     
-    while (count-- > 0) {
-      // Return next free frame to caller
-      page_frames.push_back(free_list_head);
-      
-      // De-link frame from head of free list
-      memory.get_bytes(reinterpret_cast<uint8_t*>(&free_list_head), 
-                       free_list_head, sizeof(Addr));
-      
-      // Clear allocated page to all 0
-      memory.put_bytes(page_frames.back(), kPageSize, &zero_page[0]);
-      
-      --page_frames_free;
+    // Clear allocated pages to all 0
+    if (clear) {
+      ClearFrames(page_frames.begin() + first, page_frames.end());
     }
     return true;
   } else {
+    ++stats.failed_allocations;
     return false;  // do nothing and return error
   }
 }
 
+bool PageFrameAllocator::AllocateContiguous(unsigned order, Addr &base,
+                                            bool clear) {
+  uint32_t frame;
+  if (order > kMaxOrder || !TakeBlock(order, frame)) {
+    ++stats.failed_allocations;
+    ++stats.failed_contiguous;
+    return false;
+  }
+  Addr count = Addr(1) << order;
+  base = frame * kPageSize;
+  page_frames_free -= count;
+  stats.frames_allocated += count;
+  stats.frames_in_use += count;
+  stats.peak_frames_in_use = std::max(stats.peak_frames_in_use,
+                                      stats.frames_in_use);
+  ++stats.contiguous_allocations;
+  
+  // Clear in runs of the zero source
+  if (clear) {
+    for (Addr done = 0; done < count; done += kClearFrames) {
+      memory.put_bytes(base + done * kPageSize,
+                       std::min(kClearFrames, count - done) * kPageSize,
+                       zero_frames);
+    }
+  }
+  return true;
+}
+
 bool PageFrameAllocator::Deallocate(Addr count,
                                     std::vector<Addr> &page_frames) {
   // If enough to deallocate
   if(count <= page_frames.size()) {
+    stats.frames_freed += count;
+    stats.frames_in_use -= count;
     while(count-- > 0) {
-      // Return next frame to head of free list
-      Addr frame = page_frames.back();
+      // Return next frame to its free list, merging it with free buddies
+      PutBlock(page_frames.back() / kPageSize, 0);
       page_frames.pop_back();
-      memory.put_bytes(frame, sizeof(Addr), 
-                       reinterpret_cast<uint8_t*>(&free_list_head));
-      free_list_head = frame;
       ++page_frames_free;
     }
     return true;
@@ -78,16 +111,209 @@ bool PageFrameAllocator::Deallocate(Addr count,
   }
 }
 
-std::string PageFrameAllocator::FreeListToString(void) const {
-  std::ostringstream out_string;
+void PageFrameAllocator::FreeContiguous(Addr base, unsigned order) {
+  Addr count = Addr(1) << order;
+  stats.frames_freed += count;
+  stats.frames_in_use -= count;
+  page_frames_free += count;
+  PutBlock(base / kPageSize, order);
+}
+
+void PageFrameAllocator::LimitFrames(Addr frame_count) {
+  // Frames not yet carved into blocks are only counted, so no list changes
+  page_frames_total = std::min(frame_count, memory.get_frame_count());
+  page_frames_free = page_frames_total;
+}
+
+AllocatorStats PageFrameAllocator::get_stats(void) const {
+  AllocatorStats current = stats;
+  current.free_frames = page_frames_free;
+  for (unsigned order = 0; order <= kMaxOrder; ++order) {
+    current.free_blocks += free_blocks[order];
+  }
+  current.free_max_blocks = free_blocks[kMaxOrder];
+  
+  // Frames above the high-water mark count as the blocks they would be
+  // carved into
+  for (Addr frame = high_water; frame < page_frames_total; ) {
+    unsigned order = CarveOrder(frame);
+    ++current.free_blocks;
+    if (order == kMaxOrder) {
+      ++current.free_max_blocks;
+    }
+    frame += Addr(1) << order;
+  }
+  return current;
+}
+
+void PageFrameAllocator::SaveState(CheckpointWriter &out) const {
+  out.Put<uint64_t>(page_frames_total);
+  out.Put<uint64_t>(page_frames_free);
+  out.Put<uint64_t>(high_water);
+  out.Put(stats);
+  for (unsigned order = 0; order <= kMaxOrder; ++order) {
+    out.Put<uint64_t>(free_blocks[order]);
+    for (uint32_t block = free_heads[order]; block != kNoFrame;
+         block = next_free[block]) {
+      out.Put(block);
+    }
+  }
+}
+
+void PageFrameAllocator::RestoreState(CheckpointReader &in) {
+  if (in.Get<uint64_t>() != page_frames_total) {
+    in.Mismatch("number of page frames");
+  }
+  page_frames_free = in.Get<uint64_t>();
+  high_water = in.Get<uint64_t>();
+  stats = in.Get<AllocatorStats>();
+  if (high_water > page_frames_total) {
+    in.Mismatch("allocator high-water mark");
+  }
+  next_free.assign(high_water, kNoFrame);
+  prev_free.assign(high_water, kNoFrame);
+  block_order.assign(high_water, -1);
+  
+  // Link each list from its tail, since blocks are linked at the head
+  std::vector<uint32_t> blocks;
+  for (unsigned order = 0; order <= kMaxOrder; ++order) {
+    free_heads[order] = kNoFrame;
+    free_blocks[order] = 0;
+    blocks.resize(in.Get<uint64_t>());
+    for (uint32_t &block : blocks) {
+      block = in.Get<uint32_t>();
+      if (block >= high_water
+          || high_water - block < (Addr(1) << order)) {
+        in.Mismatch("free block outside allocated frames");
+      }
+    }
+    for (auto block = blocks.rbegin(); block != blocks.rend(); ++block) {
+      LinkBlock(*block, order);
+    }
+  }
+}
+
+bool PageFrameAllocator::TakeBlock(unsigned order, uint32_t &frame) {
+  // Find the smallest free block large enough
+  unsigned found = order;
+  while (found <= kMaxOrder && free_heads[found] == kNoFrame) {
+    ++found;
+    if (found > kMaxOrder && CarveBlock()) {
+      found = order;  // look again with the new block
+    }
+  }
+  if (found > kMaxOrder) {
+    return false;
+  }
+  frame = free_heads[found];
+  UnlinkBlock(frame, found);
   
-  Addr next_free = free_list_head;
+  // Split it, freeing the upper halves
+  while (found > order) {
+    --found;
+    LinkBlock(frame + (uint32_t(1) << found), found);
+  }
+  return true;
+}
+
+void PageFrameAllocator::PutBlock(uint32_t frame, unsigned order) {
+  while (order < kMaxOrder) {
+    uint32_t buddy = frame ^ (uint32_t(1) << order);
+    if (buddy >= high_water || block_order[buddy] != static_cast<int8_t>(order)) {
+      break;
+    }
+    UnlinkBlock(buddy, order);
+    frame = std::min(frame, buddy);
+    ++order;
+  }
+  LinkBlock(frame, order);
+}
+
+unsigned PageFrameAllocator::CarveOrder(Addr frame) const {
+  unsigned order = kMaxOrder;
+  while ((frame & ((Addr(1) << order) - 1)) != 0
+         || page_frames_total - frame < (Addr(1) << order)) {
+    --order;
+  }
+  return order;
+}
+
+bool PageFrameAllocator::CarveBlock(void) {
+  if (high_water == page_frames_total) {
+    return false;
+  }
+  unsigned order = CarveOrder(high_water);
+  uint32_t frame = high_water;
+  high_water += Addr(1) << order;
+  next_free.resize(high_water);
+  prev_free.resize(high_water);
+  block_order.resize(high_water, -1);
+  PutBlock(frame, order);
+  return true;
+}
+
+void PageFrameAllocator::LinkBlock(uint32_t frame, unsigned order) {
+  uint32_t head = free_heads[order];
+  next_free[frame] = head;
+  prev_free[frame] = kNoFrame;
+  if (head != kNoFrame) {
+    prev_free[head] = frame;
+  }
+  free_heads[order] = frame;
+  block_order[frame] = order;
+  ++free_blocks[order];
+}
+
+void PageFrameAllocator::UnlinkBlock(uint32_t frame, unsigned order) {
+  uint32_t next = next_free[frame];
+  uint32_t prev = prev_free[frame];
+  if (prev == kNoFrame) {
+    free_heads[order] = next;
+  } else {
+    next_free[prev] = next;
+  }
+  if (next != kNoFrame) {
+    prev_free[next] = prev;
+  }
+  block_order[frame] = -1;
+  --free_blocks[order];
+}
+
+void PageFrameAllocator::ClearFrames(std::vector<Addr>::const_iterator first,
+                                     std::vector<Addr>::const_iterator last) {
+  while (first != last) {
+    // Find run of adjacent frames
+    Addr run_start = *first;
+    Addr run_frames = 1;
+    while (++first != last && run_frames < kClearFrames
+           && *first == run_start + run_frames * kPageSize) {
+      ++run_frames;
+    }
+    memory.put_bytes(run_start, run_frames * kPageSize, zero_frames);
+  }
+}
+
+std::string PageFrameAllocator::FreeListToString(Addr limit) const {
+  std::ostringstream out_string;
+  out_string << std::hex;
   
-  while (next_free != kEndList) {
-    out_string << " " << std::hex << next_free;
-    memory.get_bytes(reinterpret_cast<uint8_t*>(&next_free), 
-                     sizeof(Addr), next_free);
+  Addr listed = 0;
+  for (unsigned order = 0; order <= kMaxOrder; ++order) {
+    for (uint32_t block = free_heads[order]; block != kNoFrame;
+         block = next_free[block]) {
+      for (Addr i = 0; i < (Addr(1) << order) && listed < limit;
+           ++i, ++listed) {
+        out_string << " " << (block + i) * kPageSize;
+      }
+    }
+  }
+  for (Addr frame = high_water; frame < page_frames_total && listed < limit;
+       ++frame, ++listed) {
+    out_string << " " << frame * kPageSize;
+  }
+  if (listed < page_frames_free) {
+    out_string << " ...";
   }
   
   return out_string.str();
-}
\ No newline at end of file
+}
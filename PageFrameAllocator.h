@@ -9,6 +9,9 @@
 #ifndef PAGEFRAMEALLOCATOR_H
 #define PAGEFRAMEALLOCATOR_H
 
+#include "Checkpoint.h"
+#include "SimulatorStats.h"
+
 #include <MMU.h>
 
 #include <cstdint>
@@ -20,9 +23,18 @@ public:
   /**
    * Constructor
    * 
-   * Builds free list of all page frames.
+   * Initially all page frames are free. Free frames are kept by a buddy
+   * system: free blocks of 2^order adjacent frames, aligned to their size,
+   * are linked in a list for each order up to kMaxOrder. A block is split
+   * to allocate a smaller one, and a freed block is merged with its buddy
+   * (the other half of the block twice its size) whenever the buddy is
+   * free too. The lists are kept in host memory (not in the page frames),
+   * so allocation never has to read simulated memory, and are built
+   * lazily: frames never allocated are those at or above a high-water mark,
+   * and are carved into blocks as needed. Construction is O(1) regardless
+   * of memory size.
    * 
-   * @param page_frame_count
+   * @param mmu memory containing the page frames
    */
   PageFrameAllocator(mem::MMU &mmu);
   
@@ -35,14 +47,34 @@ public:
   PageFrameAllocator &operator=(PageFrameAllocator &&other) = delete;
   
   /**
-   * Allocate - allocate page frames from the free list.  Allocated pages
-   *   are cleared to all 0.
+   * Allocate - allocate page frames, one at a time from the smallest free
+   *   blocks, so consecutive frames tend to be adjacent.  Allocated pages
+   *   are cleared to all 0 unless the caller will overwrite them. Physically
+   *   adjacent frames are cleared with a single write. The MMU must be in
+   *   physical mode.
    * 
    * @param count number of page frames to allocate
    * @param page_frames page frame addresses allocated are pushed on back
+   * @param clear false if the caller will overwrite every byte of the
+   *   allocated frames, so they need not be cleared
    * @return true if success, false if insufficient page frames (no frames allocated)
    */
-  bool Allocate(mem::Addr count, std::vector<mem::Addr> &page_frames);
+  bool Allocate(mem::Addr count, std::vector<mem::Addr> &page_frames,
+                bool clear = true);
+  
+  /**
+   * AllocateContiguous - allocate a block of 2^order physically adjacent
+   *   page frames, aligned to its size. The MMU must be in physical mode.
+   *   The block may be freed with FreeContiguous, or its frames one at a
+   *   time with Deallocate.
+   * 
+   * @param order log2 of number of frames, at most kMaxOrder
+   * @param base returns physical address of the first frame
+   * @param clear false if the caller will overwrite every byte of the frames
+   * @return true if success, false if there is no free block of the size
+   *   (no frames allocated)
+   */
+  bool AllocateContiguous(unsigned order, mem::Addr &base, bool clear = true);
   
   /**
    * Deallocate - return page frames to free list
@@ -54,33 +86,134 @@ public:
    */
   bool Deallocate(mem::Addr count, std::vector<mem::Addr> &page_frames);
   
+  /**
+   * FreeContiguous - return a block allocated by AllocateContiguous
+   * 
+   * @param base physical address of the first frame
+   * @param order order the block was allocated with
+   */
+  void FreeContiguous(mem::Addr base, unsigned order);
+  
+  /**
+   * LimitFrames - allocate only the first frame_count page frames of
+   *   memory, leaving the rest unused. Must be called before any frame is
+   *   allocated.
+   * 
+   * @param frame_count number of page frames, at most the size of memory
+   */
+  void LimitFrames(mem::Addr frame_count);
+  
   // Access to private values
   mem::Addr get_page_frames_free(void) const { return page_frames_free; }
   
   /**
-   * FreeListToString - get string representation of free list
+   * get_stats - allocation counters, and the current fragmentation of the
+   *   free frames
+   */
+  AllocatorStats get_stats(void) const;
+  
+  /**
+   * FreeListToString - get string representation of the free frames, by
+   *   block from the smallest blocks up, then the frames never allocated.
+   *   For the number of free frames use get_page_frames_free, which doesn't
+   *   walk the lists.
    * 
-   * @return hex numbers of all free pages
+   * @param limit largest number of frames to list; " ..." is appended if
+   *   there are more
+   * @return hex numbers of free pages
+   */
+  std::string FreeListToString(mem::Addr limit = ~mem::Addr(0)) const;
+  
+  /**
+   * SaveState - write the free blocks, in list order, and the counters to
+   *   a checkpoint. The lists cover only frames below the high-water mark,
+   *   so the size doesn't depend on the size of memory.
+   */
+  void SaveState(CheckpointWriter &out) const;
+  
+  /**
+   * RestoreState - replace the free blocks and counters with those read
+   *   from a checkpoint written by SaveState, for the same size of memory.
+   *   The contents of frames in use are restored by their owners.
    */
-  std::string FreeListToString(void) const;
+  void RestoreState(CheckpointReader &in);
   
   static const mem::Addr kPageSize = 0x1000;
+  
+  // Largest block: the frames mapped by one L2 page table
+  static const unsigned kMaxOrder = mem::kPageTableSizeBits;
 private:
   // Memory to be allocated
   mem::MMU &memory;
   
-  // Number of first free page frame
-  mem::Addr free_list_head;
-  
   // Total number of page frames
   mem::Addr page_frames_total;
   
   // Current number of free page frames
   mem::Addr page_frames_free;
   
-  // End of list marker
-  static const mem::Addr kEndList = 0xFFFFFFFF;
+  // Frames (by number) from high_water up are free and not yet in a block
+  mem::Addr high_water;
+  
+  // Free blocks of each order: doubly linked lists through the frame
+  // numbers of the first frames of the blocks. Vectors indexed by frame
+  // number cover the frames below high_water; block_order is the order of
+  // the free block starting at a frame, or -1.
+  static const uint32_t kNoFrame = 0xFFFFFFFF;
+  uint32_t free_heads[kMaxOrder + 1];
+  uint64_t free_blocks[kMaxOrder + 1];
+  std::vector<uint32_t> next_free;
+  std::vector<uint32_t> prev_free;
+  std::vector<int8_t> block_order;
+  
+  // Allocation counters
+  AllocatorStats stats;
+  
+  /**
+   * TakeBlock - remove a free block of an order, splitting a larger one (or
+   *   carving new blocks from the high-water mark) if needed. Doesn't
+   *   update counts of free frames.
+   * 
+   * @param order order of block
+   * @param frame returns number of its first frame
+   * @return false if there is no free block large enough
+   */
+  bool TakeBlock(unsigned order, uint32_t &frame);
+  
+  /**
+   * PutBlock - add a free block, merging it with its buddy while the buddy
+   *   is free. Doesn't update counts of free frames.
+   */
+  void PutBlock(uint32_t frame, unsigned order);
+  
+  /**
+   * CarveBlock - make the largest aligned block of frames at the high-water
+   *   mark a free block
+   * 
+   * @return false if every frame is below the high-water mark
+   */
+  bool CarveBlock(void);
+  
+  /**
+   * CarveOrder - order of the block CarveBlock takes at a frame
+   */
+  unsigned CarveOrder(mem::Addr frame) const;
+  
+  /**
+   * LinkBlock, UnlinkBlock - add a block to the head of the free list of
+   *   its order, or remove it
+   */
+  void LinkBlock(uint32_t frame, unsigned order);
+  void UnlinkBlock(uint32_t frame, unsigned order);
+  
+  /**
+   * ClearFrames - clear page frames to all 0, coalescing adjacent frames.
+   * 
+   * @param first iterator to first frame address to clear
+   * @param last iterator past the last frame address to clear
+   */
+  void ClearFrames(std::vector<mem::Addr>::const_iterator first,
+                   std::vector<mem::Addr>::const_iterator last);
 };
 
 #endif /* PAGEFRAMEALLOCATOR_H */
-
@@ -0,0 +1,116 @@
+/*
+ * PageReplacer implementation
+ */
+
+/*
+ * File:   PageReplacer.cpp
+ */
+
+#include "PageReplacer.h"
+#include "ProcessTrace.h"
+
+using mem::Addr;
+using mem::kPageSize;
+using mem::kPageSizeBits;
+
+bool PageReplacer::PolicyFromName(const std::string &name, Policy &policy) {
+  if (name == "clock") {
+    policy = kClock;
+  } else if (name == "aging") {
+    policy = kAging;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+PageReplacer::PageReplacer(mem::MMU &memory_, PageFrameAllocator &allocator_,
+                           const std::string &swap_file, Policy policy_)
+: memory(memory_), allocator(allocator_), swap(swap_file), policy(policy_),
+  frames(memory_.get_frame_count()), epoch(1), hand(0) {
+}
+
+void PageReplacer::Add(Addr frame, ProcessTrace *owner, Addr vaddr,
+                       uint32_t slot, bool dirty) {
+  Frame &f = frames[frame >> kPageSizeBits];
+  f.owner = owner;
+  f.vaddr = vaddr;
+  f.slot = slot;
+  f.pin_epoch = epoch;
+  f.age = 0;
+  f.referenced = true;
+  f.dirty = dirty || slot == SwapStore::kNoSlot;
+}
+
+void PageReplacer::Remove(Addr frame) {
+  Frame &f = frames[frame >> kPageSizeBits];
+  if (f.slot != SwapStore::kNoSlot) {
+    swap.Free(f.slot);
+  }
+  f = Frame();
+}
+
+bool PageReplacer::Evict(void) {
+  size_t victim = policy == kClock ? ChooseClock() : ChooseAging();
+  if (victim == frames.size()) {
+    return false;
+  }
+
+  // Write the page to swap unless its slot already holds it
+  Frame &f = frames[victim];
+  Addr frame = static_cast<Addr>(victim) << kPageSizeBits;
+  bool written = f.dirty;
+  if (written) {
+    if (f.slot == SwapStore::kNoSlot) {
+      f.slot = swap.Allocate();
+    }
+    memory.get_bytes(swap.Slot(f.slot), frame, kPageSize);
+  }
+  f.owner->PageEvicted(f.vaddr, f.slot, written);
+  f = Frame();
+
+  std::vector<Addr> freed(1, frame);
+  allocator.Deallocate(1, freed);
+  return true;
+}
+
+size_t PageReplacer::ChooseClock(void) {
+  // Two sweeps clear every reference bit, so a victim is found unless all
+  // candidates are pinned
+  size_t count = frames.size();
+  for (size_t n = 0; n < 2 * count; ++n) {
+    size_t i = hand;
+    hand = hand + 1 == count ? 0 : hand + 1;
+    Frame &f = frames[i];
+    if (f.owner == nullptr || f.pin_epoch == epoch) {
+      continue;
+    }
+    if (f.referenced) {
+      f.referenced = false;
+    } else {
+      return i;
+    }
+  }
+  return count;
+}
+
+size_t PageReplacer::ChooseAging(void) {
+  // Age every page; the scan starts at the hand, so ties go round robin
+  size_t count = frames.size();
+  size_t victim = count;
+  for (size_t n = 0, i = hand; n < count; ++n, i = i + 1 == count ? 0 : i + 1) {
+    Frame &f = frames[i];
+    if (f.owner == nullptr) {
+      continue;
+    }
+    f.age = (f.age >> 1) | (f.referenced ? 0x80 : 0);
+    f.referenced = false;
+    if (f.pin_epoch != epoch && (victim == count || f.age < frames[victim].age)) {
+      victim = i;
+    }
+  }
+  if (victim != count) {
+    hand = victim + 1 == count ? 0 : victim + 1;
+  }
+  return victim;
+}
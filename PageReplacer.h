@@ -0,0 +1,174 @@
+/*
+ * PageReplacer - chooses data pages to evict from physical memory when the
+ * page frame allocator runs out of frames, and moves evicted pages to and
+ * from a swap file (see SwapStore).
+ *
+ * There is one replacer per MMU, shared by every process in that memory.
+ * Only private data pages are candidates: page tables and shared frames
+ * (PageSharing) stay resident. The MMU's page table entries have no accessed
+ * or modified bits, so the replacer keeps its own reference and dirty bit
+ * for each frame, set by the process when a command touches the page (see
+ * ProcessTrace::PrepareRange). A page is written to swap only if it is
+ * dirty or was never written there; a page swapped in keeps its slot, so
+ * evicting it again while clean costs no write.
+ *
+ * Pages are pinned from when a process prepares them for an access until it
+ * unpins them, so a page is not evicted between being swapped in and being
+ * used. Processes work through long ranges in pieces, unpinning between
+ * pieces, so a command may cover more pages than fit in physical memory.
+ *
+ * Policies:
+ *   clock - second chance: a hand sweeps the frames in physical order,
+ *     clearing reference bits, and evicts the first unreferenced page.
+ *   aging - LRU approximation: at each eviction every page's age counter is
+ *     shifted right with its reference bit shifted in at the top, and the
+ *     page with the lowest age is evicted. Costs a scan of all frames per
+ *     eviction.
+ */
+
+/*
+ * File:   PageReplacer.h
+ */
+
+#ifndef PAGEREPLACER_H
+#define PAGEREPLACER_H
+
+#include "PageFrameAllocator.h"
+#include "SwapStore.h"
+
+#include <MMU.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class ProcessTrace;
+
+class PageReplacer {
+public:
+  /**
+   * Policy - how victims are chosen
+   */
+  enum Policy {
+    kClock,
+    kAging
+  };
+
+  /**
+   * PolicyFromName - get a policy by its command line name
+   *
+   * @param name "clock" or "aging"
+   * @param policy returns the policy
+   * @return false if the name is not valid
+   */
+  static bool PolicyFromName(const std::string &name, Policy &policy);
+
+  /**
+   * Constructor - create the swap file (see SwapStore)
+   *
+   * @param memory_ MMU holding the pages
+   * @param allocator_ allocator evicted frames are returned to
+   * @param swap_file name of swap file to create
+   * @param policy_ victim selection policy
+   */
+  PageReplacer(mem::MMU &memory_, PageFrameAllocator &allocator_,
+               const std::string &swap_file, Policy policy_);
+  virtual ~PageReplacer() {}
+
+  // Disallow copy/move
+  PageReplacer(const PageReplacer &other) = delete;
+  PageReplacer(PageReplacer &&other) = delete;
+  PageReplacer &operator=(const PageReplacer &other) = delete;
+  PageReplacer &operator=(PageReplacer &&other) = delete;
+
+  /**
+   * Unpin - release all pinned pages
+   */
+  void Unpin(void) { ++epoch; }
+
+  /**
+   * Add - make a newly mapped data page a candidate for eviction. The page
+   *   is referenced and pinned.
+   *
+   * @param frame physical address of the page frame
+   * @param owner process the page belongs to
+   * @param vaddr virtual address of the page in owner
+   * @param slot swap slot holding a copy of the page, or SwapStore::kNoSlot
+   * @param dirty false if the slot holds the current contents
+   */
+  void Add(mem::Addr frame, ProcessTrace *owner, mem::Addr vaddr,
+           uint32_t slot, bool dirty);
+
+  /**
+   * Reference - note a use of a resident page, and pin it until the next
+   *   Unpin
+   *
+   * @param frame physical address of the page frame
+   * @param write true if the page will be written
+   */
+  void Reference(mem::Addr frame, bool write) {
+    Frame &f = frames[frame >> mem::kPageSizeBits];
+    f.referenced = true;
+    f.dirty = f.dirty || write;
+    f.pin_epoch = epoch;
+  }
+
+  /**
+   * Remove - stop tracking a page whose owner is releasing its frame, and
+   *   free its swap slot
+   */
+  void Remove(mem::Addr frame);
+
+  /**
+   * Evict - evict a page: write it to swap if needed, tell its owner (see
+   *   ProcessTrace::PageEvicted) and return its frame to the allocator.
+   *   The MMU must be in physical mode.
+   *
+   * @return false if every candidate page is pinned (nothing evicted)
+   */
+  bool Evict(void);
+
+  /**
+   * ReadSlot - copy a page from swap to a frame. The MMU must be in
+   *   physical mode.
+   */
+  void ReadSlot(uint32_t slot, mem::Addr frame) {
+    memory.put_bytes(frame, mem::kPageSize, swap.Slot(slot));
+  }
+
+  /**
+   * FreeSlot - free the swap slot of a page which is no longer needed
+   */
+  void FreeSlot(uint32_t slot) { swap.Free(slot); }
+
+private:
+  mem::MMU &memory;
+  PageFrameAllocator &allocator;
+  SwapStore swap;
+  Policy policy;
+
+  // Replacement state of each page frame, indexed by frame number; owner is
+  // null for frames which are free or not candidates
+  struct Frame {
+    ProcessTrace *owner = nullptr;
+    mem::Addr vaddr = 0;
+    uint32_t slot = SwapStore::kNoSlot;
+    uint32_t pin_epoch = 0;  // pinned while equal to epoch
+    uint8_t age = 0;
+    bool referenced = false;
+    bool dirty = false;
+  };
+  std::vector<Frame> frames;
+  uint32_t epoch;  // incremented by Unpin
+  size_t hand;     // next frame the policy looks at
+
+  /**
+   * ChooseClock, ChooseAging - pick a victim by each policy
+   *
+   * @return frame number of victim, or frames.size() if none
+   */
+  size_t ChooseClock(void);
+  size_t ChooseAging(void);
+};
+
+#endif /* PAGEREPLACER_H */
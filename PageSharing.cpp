@@ -0,0 +1,83 @@
+/*
+ * PageSharing implementation
+ */
+
+/*
+ * File:   PageSharing.cpp
+ */
+
+#include "PageSharing.h"
+
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+using mem::Addr;
+using mem::kPageSize;
+
+PageSharing::PageSharing(mem::MMU &memory_, PageFrameAllocator &allocator_)
+: memory(memory_), allocator(allocator_), references(0), buffer(kPageSize) {
+}
+
+bool PageSharing::Share(const uint8_t *contents, Addr &frame) {
+  size_t hash = std::hash<std::string_view>()(std::string_view(
+          reinterpret_cast<const char*>(contents), kPageSize));
+
+  // Look for a frame with the same contents (not just the same hash)
+  auto range = by_hash.equal_range(hash);
+  for (auto candidate = range.first; candidate != range.second; ++candidate) {
+    memory.get_bytes(buffer.data(), candidate->second, kPageSize);
+    if (std::memcmp(buffer.data(), contents, kPageSize) == 0) {
+      frame = candidate->second;
+      ++frames[frame].refs;
+      ++references;
+      return true;
+    }
+  }
+
+  // Make a new shared frame
+  std::vector<Addr> allocated;
+  if (!allocator.Allocate(1, allocated, false)) {
+    return false;
+  }
+  frame = allocated[0];
+  memory.put_bytes(frame, kPageSize, contents);
+  frames[frame] = SharedFrame{hash, 1};
+  by_hash.emplace(hash, frame);
+  ++references;
+  return true;
+}
+
+void PageSharing::Release(Addr frame) {
+  auto found = frames.find(frame);
+  if (found == frames.end()) {
+    return;
+  }
+  --references;
+  if (--found->second.refs == 0) {
+    Unregister(frame, found->second.hash);
+    std::vector<Addr> freed(1, frame);
+    allocator.Deallocate(1, freed);
+  }
+}
+
+bool PageSharing::TakePrivate(Addr frame) {
+  auto found = frames.find(frame);
+  if (found == frames.end() || found->second.refs != 1) {
+    return false;
+  }
+  --references;
+  Unregister(frame, found->second.hash);
+  return true;
+}
+
+void PageSharing::Unregister(Addr frame, size_t hash) {
+  auto range = by_hash.equal_range(hash);
+  for (auto candidate = range.first; candidate != range.second; ++candidate) {
+    if (candidate->second == frame) {
+      by_hash.erase(candidate);
+      break;
+    }
+  }
+  frames.erase(frame);
+}
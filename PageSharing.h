@@ -0,0 +1,108 @@
+/*
+ * PageSharing - registry of page frames shared read-only by processes whose
+ * pages have identical contents (the --dedup mode).
+ *
+ * When a process writes a whole page which is not yet present (a put or
+ * fill covering the page), it asks the registry for a frame with the same
+ * contents, zero-filled pages being the most common case. If there is one,
+ * the page is mapped to it without allocating a frame; otherwise a new
+ * frame is written and registered, so later processes can share it. Shared
+ * pages are mapped read-only, and are replaced by a private copy (or, for
+ * the last user, made private again) when the process first writes them.
+ *
+ * A registered frame belongs to the registry, not to any process: each
+ * process mapping it holds a reference, and the frame is returned to the
+ * allocator when the last reference is released. There is one registry per
+ * MMU; it is only used by the thread running that MMU's processes.
+ */
+
+/*
+ * File:   PageSharing.h
+ */
+
+#ifndef PAGESHARING_H
+#define PAGESHARING_H
+
+#include "PageFrameAllocator.h"
+
+#include <MMU.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class PageSharing {
+public:
+  /**
+   * Constructor
+   *
+   * @param memory_ memory holding the shared frames
+   * @param allocator_ allocator of memory_'s frames
+   */
+  PageSharing(mem::MMU &memory_, PageFrameAllocator &allocator_);
+  virtual ~PageSharing() {}
+
+  // Disallow copy/move
+  PageSharing(const PageSharing &other) = delete;
+  PageSharing(PageSharing &&other) = delete;
+  PageSharing &operator=(const PageSharing &other) = delete;
+  PageSharing &operator=(PageSharing &&other) = delete;
+
+  /**
+   * Share - find a shared frame with the given contents, or make one. The
+   *   caller gets a reference to the frame. The MMU must be in physical
+   *   mode.
+   *
+   * @param contents kPageSize bytes of page contents
+   * @param frame returns the physical address of the frame
+   * @return true if success, false if no frame could be allocated
+   */
+  bool Share(const uint8_t *contents, mem::Addr &frame);
+
+  /**
+   * Release - drop a reference to a shared frame, freeing the frame if it
+   *   was the last
+   *
+   * @param frame physical address of frame
+   */
+  void Release(mem::Addr frame);
+
+  /**
+   * TakePrivate - unregister a shared frame if the caller holds the only
+   *   reference, so the caller owns it (and may write it)
+   *
+   * @param frame physical address of frame
+   * @return true if the caller now owns the frame, false if it is still
+   *   shared by others
+   */
+  bool TakePrivate(mem::Addr frame);
+
+  // Number of shared frames, and references to them
+  size_t get_frames(void) const { return frames.size(); }
+  uint64_t get_references(void) const { return references; }
+
+private:
+  mem::MMU &memory;
+  PageFrameAllocator &allocator;
+
+  /**
+   * SharedFrame - a registered frame
+   */
+  struct SharedFrame {
+    size_t hash;     // hash of contents
+    uint64_t refs;   // processes mapping the frame
+  };
+  std::unordered_map<mem::Addr, SharedFrame> frames;  // by frame address
+  std::unordered_multimap<size_t, mem::Addr> by_hash; // frames by hash
+  uint64_t references;
+
+  // Contents of a candidate frame, read for comparison
+  std::vector<uint8_t> buffer;
+
+  /**
+   * Unregister - remove a frame from the registry
+   */
+  void Unregister(mem::Addr frame, size_t hash);
+};
+
+#endif /* PAGESHARING_H */
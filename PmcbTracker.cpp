@@ -0,0 +1,28 @@
+/*
+ * PmcbTracker implementation
+ */
+
+/*
+ * File:   PmcbTracker.cpp
+ */
+
+#include "PmcbTracker.h"
+
+PmcbTracker::PmcbTracker(mem::MMU &memory_)
+: memory(memory_), loaded_owner(nullptr), loaded_physical(false),
+  switches(0), skipped(0) {
+}
+
+void PmcbTracker::Reload(const void *owner, bool physical,
+                         const mem::PMCB &pmcb) {
+  memory.set_PMCB(pmcb);
+  loaded_owner = owner;
+  loaded_physical = physical;
+  ++switches;
+}
+
+void PmcbTracker::Forget(const void *owner) {
+  if (loaded_owner == owner) {
+    loaded_owner = nullptr;
+  }
+}
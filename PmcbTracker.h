@@ -0,0 +1,83 @@
+/*
+ * PmcbTracker - tracks which process control block is loaded in an MMU, so
+ * that loading the one already there can be skipped.
+ *
+ * Every process running in an MMU loads its PMCBs through the MMU's tracker.
+ * The tracker remembers the owner (process) and mode (virtual or physical)
+ * of the PMCB loaded last; Load is a no-op when asked for the same owner and
+ * mode again. This relies on a loaded PMCB never changing behind the
+ * tracker's back: a memory operation which completes leaves the PMCB as it
+ * was, and one which faults leaves its state in the PMCB until the owner
+ * clears it, which must be done with Reload.
+ */
+
+/*
+ * File:   PmcbTracker.h
+ */
+
+#ifndef PMCBTRACKER_H
+#define PMCBTRACKER_H
+
+#include <MMU.h>
+
+#include <cstdint>
+
+class PmcbTracker {
+public:
+  /**
+   * Constructor
+   *
+   * @param memory_ MMU whose PMCB is tracked
+   */
+  PmcbTracker(mem::MMU &memory_);
+  virtual ~PmcbTracker() {}
+
+  // Disallow copy/move
+  PmcbTracker(const PmcbTracker &other) = delete;
+  PmcbTracker(PmcbTracker &&other) = delete;
+  PmcbTracker &operator=(const PmcbTracker &other) = delete;
+  PmcbTracker &operator=(PmcbTracker &&other) = delete;
+
+  /**
+   * Load - load a PMCB unless it is already loaded
+   *
+   * @param owner process the PMCB belongs to
+   * @param physical true for the owner's physical mode PMCB, false for its
+   *   virtual mode PMCB
+   * @param pmcb the PMCB
+   * @return true if the PMCB was loaded, false if it was already loaded
+   */
+  bool Load(const void *owner, bool physical, const mem::PMCB &pmcb) {
+    if (owner != loaded_owner || physical != loaded_physical) {
+      Reload(owner, physical, pmcb);
+      return true;
+    }
+    ++skipped;
+    return false;
+  }
+
+  /**
+   * Reload - load a PMCB even if it is already loaded (because its contents
+   *   changed)
+   */
+  void Reload(const void *owner, bool physical, const mem::PMCB &pmcb);
+
+  /**
+   * Forget - note that an owner no longer exists, so a new owner at the same
+   *   address is not mistaken for it
+   */
+  void Forget(const void *owner);
+
+  // Number of PMCB loads done and skipped
+  uint64_t get_switches(void) const { return switches; }
+  uint64_t get_skipped(void) const { return skipped; }
+
+private:
+  mem::MMU &memory;
+  const void *loaded_owner;  // null if unknown
+  bool loaded_physical;
+  uint64_t switches;
+  uint64_t skipped;
+};
+
+#endif /* PMCBTRACKER_H */
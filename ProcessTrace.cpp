@@ -9,451 +9,1335 @@
  */
 
 #include "ProcessTrace.h"
+#include "TraceFormat.h"
+#include "TraceScanner.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cctype>
-#include <iomanip>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+
+#include <time.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 using namespace mem;
+using namespace trace_format;
 
-using std::cin;
-using std::cout;
 using std::cerr;
-using std::getline;
-using std::istringstream;
 using std::string;
+using std::string_view;
 using std::vector;
 
+namespace {
+/*
+ * MismatchMask - compare a block of kMatchBlock bytes with vector compares
+ *   (AVX2, SSE2 or NEON, else a byte loop)
+ *
+ * @param actual bytes read
+ * @param expected expected bytes
+ * @return mask with bit i set if byte i differs
+ */
+const Addr kMatchBlock = 32;
+
+#if defined(__AVX2__)
+inline uint32_t MismatchMask(const uint8_t *actual, const uint8_t *expected) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (actual));
+    __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (expected));
+    return ~static_cast<uint32_t> (_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, e)));
+}
+#elif defined(__SSE2__)
+inline uint32_t MismatchMask(const uint8_t *actual, const uint8_t *expected) {
+    const __m128i *a = reinterpret_cast<const __m128i*> (actual);
+    const __m128i *e = reinterpret_cast<const __m128i*> (expected);
+    uint32_t low = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128(a), _mm_loadu_si128(e)));
+    uint32_t high = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128(a + 1), _mm_loadu_si128(e + 1)));
+    return ~(low | high << 16);
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+// NEON has no movemask: weight each byte of the compare result by its bit
+// and add across each half
+inline uint32_t NeonMask16(const uint8_t *actual, const uint8_t *expected) {
+    static const uint8_t kBits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t ne = vmvnq_u8(vceqq_u8(vld1q_u8(actual), vld1q_u8(expected)));
+    uint8x16_t bits = vandq_u8(ne, vld1q_u8(kBits));
+    return vaddv_u8(vget_low_u8(bits)) | vaddv_u8(vget_high_u8(bits)) << 8;
+}
+
+inline uint32_t MismatchMask(const uint8_t *actual, const uint8_t *expected) {
+    return NeonMask16(actual, expected)
+            | NeonMask16(actual + 16, expected + 16) << 16;
+}
+#else
+inline uint32_t MismatchMask(const uint8_t *actual, const uint8_t *expected) {
+    uint32_t mask = 0;
+    for (Addr i = 0; i < kMatchBlock; ++i) {
+        mask |= static_cast<uint32_t> (actual[i] != expected[i]) << i;
+    }
+    return mask;
+}
+#endif
+
+/*
+ * ForEachMismatch - call report with the index of each byte which differs
+ *   from its expected value, in order. Matching blocks cost one vector
+ *   compare; only the set bits of a mismatch mask are visited.
+ *
+ * @param actual bytes read
+ * @param expected expected bytes
+ * @param count number of bytes
+ * @param report function taking index of a mismatch
+ */
+template <typename Report>
+void ForEachMismatch(const uint8_t *actual, const uint8_t *expected,
+        Addr count, Report report) {
+    Addr i = 0;
+    for (; i + kMatchBlock <= count; i += kMatchBlock) {
+        for (uint32_t mask = MismatchMask(actual + i, expected + i); mask != 0;
+                mask &= mask - 1) {
+            report(i + __builtin_ctz(mask));
+        }
+    }
+    for (; i < count; ++i) {
+        if (actual[i] != expected[i]) {
+            report(i);
+        }
+    }
+}
+}
+
 ProcessTrace::ProcessTrace(MMU &memory_,
         PageFrameAllocator &allocator_,
+        PmcbTracker &pmcb_tracker_,
         string file_name_, int id)
-: memory(memory_), allocator(allocator_), file_name(file_name_),
-line_number(0), id_number(id), allocated_pages(0) {
-    // Open the trace file.  Abort program if can't open.
-    trace.open(file_name, std::ios_base::in);
-    if (!trace.is_open()) {
-        cerr << "ERROR: failed to open trace file: " << file_name << "\n";
-        exit(2);
-    }
+: ProcessTrace(memory_, allocator_, pmcb_tracker_,
+               TraceFile::Open(file_name_), file_name_, id) {
+}
+
+ProcessTrace::ProcessTrace(MMU &memory_,
+        PageFrameAllocator &allocator_,
+        PmcbTracker &pmcb_tracker_,
+        std::shared_ptr<TraceFile> trace_,
+        string file_name_, int id)
+: file_name(file_name_), trace(trace_), trace_offset(0), binary_trace(false),
+line_number(0), id_number(id), allocated_pages(0),
+memory(memory_), pmcb_tracker(pmcb_tracker_), allocator(allocator_),
+page_sharing(nullptr), page_replacer(nullptr), prefetcher(nullptr),
+prefetch_stream(nullptr), prefetch_report(SIZE_MAX),
+timing(false), huge_pages(false), bytes_moved(0) {
+    stats.id = id;
 
-    vector<mem::Addr> allocated;
-    memory.set_PMCB(pmem_pmcb);
-    allocator.Allocate(1, allocated);
-    vmem_pmcb = mem::PMCB(true, allocated[0]); // initialize PMCB
-    memory.set_PMCB(vmem_pmcb);
+    // Detect binary trace format from the magic number
+    if (trace->get_size() >= kBinaryTraceMagicSize
+            && std::equal(trace->begin(), trace->begin() + kBinaryTraceMagicSize,
+                          reinterpret_cast<const char*> (kBinaryTraceMagic))) {
+        binary_trace = true;
+        trace_offset = kBinaryTraceMagicSize;
+    }
 }
 
 ProcessTrace::~ProcessTrace() {
-    trace.close();
+    pmcb_tracker.Forget(this);
+    if (prefetcher != nullptr) {
+        prefetcher->Remove(prefetch_stream);
+    }
+
+    // Drop references to shared frames, and return all data and page table
+    // frames to the allocator, and swap slots to the replacer. A region
+    // still mapped to the block MapRegion gave it is freed as one block.
+    for (const std::unique_ptr<ShadowTable> &table : shadow_tables) {
+        if (!table) {
+            continue;
+        }
+        bool whole_block = table->region_block;
+        Addr base = table->entries[0] & kPageNumberMask;
+        for (Addr i = 0; whole_block && i < kPageTableEntries; ++i) {
+            whole_block = (table->entries[i] & kPTE_PresentMask) != 0
+                    && (table->entries[i] & kPageNumberMask)
+                       == base + i * kPageSize;
+        }
+        if (whole_block) {
+            for (Addr i = 0; page_replacer != nullptr && i < kPageTableEntries;
+                    ++i) {
+                page_replacer->Remove(base + i * kPageSize);
+            }
+            allocator.FreeContiguous(base, kPageTableSizeBits);
+            continue;
+        }
+        for (Addr i = 0; i < kPageTableEntries; ++i) {
+            PageTableEntry entry = table->entries[i];
+            if ((entry & kPTE_PresentMask) == 0) {
+                continue;
+            }
+            Addr frame = entry & kPageNumberMask;
+            if (table->shared[i]) {
+                page_sharing->Release(frame);
+            } else {
+                if (page_replacer != nullptr) {
+                    page_replacer->Remove(frame);
+                }
+                owned_frames.push_back(frame);
+            }
+        }
+    }
+    for (const auto &swapped : swapped_pages) {
+        page_replacer->FreeSlot(swapped.second.slot);
+    }
+    allocator.Deallocate(owned_frames.size(), owned_frames);
+}
+
+// Definition for uses by reference (std::min)
+const Addr ProcessTrace::kScratchLimit;
+const Addr ProcessTrace::kRegionSize;
+
+const PMCB ProcessTrace::kPhysicalPmcb(false, 0);
+
+const ProcessTrace::CmdHandler ProcessTrace::kCmdHandlers[kOpCount] = {
+    &ProcessTrace::CmdComment,
+    &ProcessTrace::CmdQuota,
+    &ProcessTrace::CmdCompare,
+    &ProcessTrace::CmdPut,
+    &ProcessTrace::CmdFill,
+    &ProcessTrace::CmdCopy,
+    &ProcessTrace::CmdDump,
+    &ProcessTrace::CmdWritable,
+    &ProcessTrace::CmdInvalid
+};
+
+void ProcessTrace::set_prefetcher(TracePrefetcher *prefetcher_,
+        TracePrefetcher::Stream *stream) {
+    prefetcher = prefetcher_;
+    prefetch_stream = stream;
+    prefetch_report = 0;
 }
 
 int ProcessTrace::Execute(int num_lines) {
+    ++stats.quanta;
+    if (!timing) {
+        return ExecuteLines(num_lines);
+    }
+
+    // Time the slice
+    auto wall_start = std::chrono::steady_clock::now();
+    struct timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    int lines = ExecuteLines(num_lines);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    uint64_t wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - wall_start).count();
+    stats.wall_ns += wall_ns;
+    stats.max_quantum_wall_ns = std::max(stats.max_quantum_wall_ns, wall_ns);
+    stats.cpu_ns += (cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000ll
+            + (cpu_end.tv_nsec - cpu_start.tv_nsec);
+    return lines;
+}
+
+int ProcessTrace::ExecuteLines(int num_lines) {
     // Read and process commands
-    string line; // text line read
-    string cmd; // command from line
+    string_view line; // text line read
+    TraceOpcode op; // command from line
     vector<uint32_t> cmdArgs; // arguments from line
 
-    //make sure MMU is in virtual mode
-    memory.set_PMCB(vmem_pmcb);
+    // Map the trace again if it was released since the last time slice
+    if (!trace) {
+        trace = TraceFile::Open(file_name);
+    }
+
+    // Allocate the L1 page table when the process first runs, so that
+    // running out of frames is reported like any other fatal error
+    if (owned_frames.empty()) {
+        try {
+            LoadPhysicalPmcb();
+            vmem_pmcb = mem::PMCB(true, AllocateFrame(true)); // initialize PMCB
+            owned_frames.push_back(vmem_pmcb.page_table_base);
+        } catch (OutOfFramesException e) {
+            OutOfFramesError();
+            return 0;
+        }
+    }
+
+    //make sure MMU is in virtual mode (skipped if this process's PMCB is
+    //still loaded from its previous time slice)
+    LoadVirtualPmcb();
 
-    // Select the command to execute
+    // Execute each command through the handler for its opcode
     for (int i = 0; i < num_lines; ++i) {
-        if (ParseCommand(line, cmd, cmdArgs)) {
-            if (cmd == "quota") {
-                CmdQuota(line, cmd, cmdArgs); // allocate memory
-            } else if (cmd == "compare") {
-                CmdCompare(line, cmd, cmdArgs); // get and compare multiple bytes
-            } else if (cmd == "put") {
-                if (!CmdPut(line, cmd, cmdArgs)) {
-                    cout << "ERROR: memory quota " << std::hex << QUOTA << " exceeded" << std::endl;
-                    return i;
-                } // put bytes
-            } else if (cmd == "fill") {
-                if (!CmdFill(line, cmd, cmdArgs)) {
-                    cout << "ERROR: memory quota " << std::hex << QUOTA << " exceeded" << std::endl;
-                    return i;
-                } // fill bytes with value
-            } else if (cmd == "copy") {
-                if (!CmdCopy(line, cmd, cmdArgs)) {
-                    cout << "ERROR: memory quota " << std::hex << QUOTA << " exceeded" << std::endl;
-                    return i;
-                } // copy bytes to dest from source
-            } else if (cmd == "dump") {
-                CmdDump(line, cmd, cmdArgs); // dump byte values to output
-            } else if (cmd == "writable") {
-                CmdWritable(line, cmd, cmdArgs); // change writable status of page(s)
-            } else {
-                if (!cmd.empty()) { // if not comment
-                    cerr << "ERROR: invalid command at line " << line_number << ":\n"
-                            << line << "\n";
-                    exit(2);
-                }
-            }
-        } else {
+        if (trace_offset >= prefetch_report) {
+            prefetch_report = prefetcher->Advance(prefetch_stream, trace_offset);
+        }
+        cmd_bytes.clear();
+        wide_values.clear();
+        if (!ParseCommand(line, op, cmdArgs)) {
             return i; //lines executed before termination
         }
+        batch_lines.clear();
+        if ((op == kOpPut || op == kOpCompare) && i + 1 < num_lines) {
+            GatherBatch(op, cmdArgs, num_lines - i - 1);
+        }
+        stats.lines[op] += 1 + batch_lines.size();
+        UnpinPages();
+        uint64_t bytes_before = bytes_moved;
+        CmdStatus status;
+        try {
+            LatencyTimer timer(stats.command_latency[op]);
+            status = (this->*kCmdHandlers[op])(line, cmdArgs);
+        } catch (OutOfFramesException e) {
+            status = OutOfFramesError();
+        }
+        stats.bytes[op] += bytes_moved - bytes_before;
+        i += batch_lines.size();
+        switch (status) {
+            case kCmdOk:
+                break;
+            case kCmdQuotaExceeded:
+                ++stats.quota_terminations;
+                PrintQuotaExceeded();
+                return i;
+            case kCmdFatal:
+                return i;
+        }
     }
-    memory.get_PMCB(vmem_pmcb);
     return num_lines;
 }
 
 bool ProcessTrace::ParseCommand(
-        string &line, string &cmd, vector<uint32_t> &cmdArgs) {
-    cmdArgs.clear();
-    line.clear();
-    cmd.clear();
-
-    // Read next line
-    if (std::getline(trace, line)) {
-        ++line_number;
-        cout << std::dec << line_number
-                << ":" << id_number << ":" << line << "\n";
+        string_view &line, TraceOpcode &op, vector<uint32_t> &cmdArgs,
+        bool echo) {
+    if (binary_trace) {
+        try {
+            return ParseBinaryCommand(line, op, cmdArgs, echo);
+        } catch (BinaryTraceException e) {
+            return false;
+        }
+    }
 
+    cmdArgs.clear();
+    op = kOpComment;
 
-        // If not comment
-        if (line.at(0) != '#') {
+    // Find next line in the mapped file
+    const char *begin = trace->begin() + trace_offset;
+    const char *end = trace->end();
+    if (begin == end) {
+        return false; // end of file
+    }
+    const char *line_end = std::find(begin, end, '\n');
+    line = string_view(begin, line_end - begin);
+    trace_offset = (line_end == end ? end : line_end + 1) - trace->begin();
 
-            // Make a string stream from command line
-            istringstream lineStream(line);
+    ++line_number;
+    if (echo) {
+        EchoLine(line);
+    }
 
-            // Get command
-            lineStream >> cmd;
+    // If not comment
+    if (line.at(0) != '#') {
+        // Get command
+        const char *p = SkipSpace(begin, line_end);
+        const char *cmd_end = ScanToken(p, line_end);
+        op = OpcodeFromName(string_view(p, cmd_end - p));
 
-            // Get arguments
-            uint32_t arg;
-            while (lineStream >> std::hex >> arg) {
+        // Get arguments; the values of put and compare are packed into
+        // cmd_bytes (put stores only the low byte), mostly by the fast
+        // path ScanHexBytes
+        bool values = op == kOpPut || op == kOpCompare;
+        uint32_t arg;
+        p = cmd_end;
+        for (;;) {
+            if (values && !cmdArgs.empty()) {
+                p = ScanHexBytes(p, line_end, cmd_bytes);
+            }
+            if ((p = ScanHex(p, line_end, arg)) == nullptr) {
+                break;
+            }
+            if (!values || cmdArgs.empty()) {
                 cmdArgs.push_back(arg);
+            } else {
+                if (op == kOpCompare && arg > 0xFF) {
+                    wide_values.emplace_back(cmd_bytes.size(), arg);
+                }
+                cmd_bytes.push_back(static_cast<uint8_t> (arg));
             }
         }
-        return true;
-    } else if (trace.eof()) {
+    }
+    return true;
+}
+
+bool ProcessTrace::ParseBinaryCommand(
+        string_view &line, TraceOpcode &op, vector<uint32_t> &cmdArgs,
+        bool echo) {
+    cmdArgs.clear();
+
+    // Read opcode; end of file is only valid at a record boundary
+    if (trace_offset == trace->get_size()) {
         return false;
-    } else {
-        cerr << "ERROR: getline failed on trace file: " << file_name
-                << "at line " << line_number << "\n";
-        exit(2);
     }
+    uint8_t op_byte = ReadBinaryBytes(1)[0];
+    bool wide = (op_byte & kWideValuesFlag) != 0;
+    op_byte &= ~kWideValuesFlag;
+    if (op_byte >= kOpCount || (wide && op_byte != kOpCompare)) {
+        BinaryTraceError();
+    }
+    op = static_cast<TraceOpcode> (op_byte);
+
+    // Echo original line text
+    uint32_t line_length = ReadVarint();
+    line = string_view(ReadBinaryBytes(line_length), line_length);
+    ++line_number;
+    if (echo) {
+        EchoLine(line);
+    }
+
+    // Decode operands into the same arguments (and cmd_bytes) the text
+    // parser builds
+    switch (op) {
+        case kOpQuota:
+            cmdArgs.push_back(ReadVarint());
+            break;
+        case kOpCompare:
+        case kOpPut:
+        {
+            cmdArgs.push_back(ReadVarint());
+            uint32_t count = ReadVarint();
+            const uint8_t *bytes =
+                    reinterpret_cast<const uint8_t*> (ReadBinaryBytes(count));
+            size_t bytes_before = cmd_bytes.size();
+            cmd_bytes.insert(cmd_bytes.end(), bytes, bytes + count);
+            // Wide values, by increasing index, as the text parser lists them
+            uint32_t next_index = 0;
+            for (uint32_t n = wide ? ReadVarint() : 0; n > 0; --n) {
+                uint32_t index = ReadVarint();
+                uint32_t value = ReadVarint();
+                if (index < next_index || index >= count) {
+                    BinaryTraceError();
+                }
+                wide_values.emplace_back(bytes_before + index, value);
+                next_index = index + 1;
+            }
+            break;
+        }
+        case kOpFill:
+            cmdArgs.push_back(ReadVarint());
+            cmdArgs.push_back(ReadVarint());
+            cmdArgs.push_back(static_cast<uint8_t> (ReadBinaryBytes(1)[0]));
+            break;
+        case kOpCopy:
+        case kOpWritable:
+            cmdArgs.push_back(ReadVarint());
+            // fall through
+        case kOpDump:
+            cmdArgs.push_back(ReadVarint());
+            cmdArgs.push_back(ReadVarint());
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+void ProcessTrace::GatherBatch(TraceOpcode op, vector<uint32_t> &cmdArgs,
+        int max_lines) {
+    Addr addr = cmdArgs.at(0);
+    Addr count = cmd_bytes.size();
+    uint64_t next_page = 0;
+    int new_pages = 0;
+    if (count == 0 || count >= kScratchLimit
+            || !CanBatch(op, addr, count, next_page, new_pages)) {
+        return;
+    }
+
+    // Take following records of the same command which continue the range.
+    // Their lines are echoed when executed, so they are parsed without
+    // echo, and the line number is put back. Their bytes are appended to
+    // cmd_bytes by the parser, and removed again if the record is not taken.
+    Addr end = addr + count;
+    while (static_cast<int> (batch_lines.size()) < max_lines) {
+        size_t offset = trace_offset;
+        long lines = line_number;
+        size_t bytes_before = cmd_bytes.size();
+        size_t wide_before = wide_values.size();
+        string_view next_line;
+        TraceOpcode next_op;
+        bool parsed = ParseCommand(next_line, next_op, lookahead_args, false);
+        line_number = lines;
+        Addr next_count = cmd_bytes.size() - bytes_before;
+        if (!parsed || next_op != op || lookahead_args.empty()
+                || next_count == 0 || lookahead_args[0] != end
+                || cmd_bytes.size() > kScratchLimit
+                || !CanBatch(op, end, next_count, next_page, new_pages)) {
+            // Leave the record to be parsed again (and any error reported)
+            // as the next command
+            trace_offset = offset;
+            error_message.clear();
+            cmd_bytes.resize(bytes_before);
+            wide_values.resize(wide_before);
+            break;
+        }
+        batch_lines.push_back(BatchLine{next_line, end - addr});
+        end += next_count;
+    }
+}
+
+bool ProcessTrace::CanBatch(TraceOpcode op, Addr addr, Addr count,
+        uint64_t &next_page, int &new_pages) {
+    uint64_t end = static_cast<uint64_t> (addr) + count;
+    if (end > (1ull << 32)) {
+        return false; // range wraps around
+    }
+
+    // Check each page not checked for an earlier record
+    for (uint64_t page = std::max<uint64_t>(next_page, addr & kPageNumberMask);
+            page < end; page += kPageSize) {
+        PageTableEntry entry = LookupPte(page);
+        bool present = (entry & kPTE_PresentMask) != 0;
+        bool writable = (entry & kPTE_WritableMask) != 0;
+        if (!present && !swapped_pages.empty()) {
+            auto swapped = swapped_pages.find(page);
+            if (swapped != swapped_pages.end()) {
+                present = true;
+                writable = swapped->second.writable;
+            }
+        }
+        if (!present) {
+            if (op == kOpCompare) {
+                return false; // read would fault
+            }
+            ++new_pages;
+        } else if (op == kOpPut && !writable) {
+            return false; // write would fault (or unshare)
+        }
+    }
+    next_page = ((end - 1) & kPageNumberMask) + kPageSize;
+
+    // Allocation must not reach the quota (see MapRange)
+    return new_pages == 0 || allocated_pages + new_pages <= QUOTA;
+}
+
+uint32_t ProcessTrace::ReadVarint(void) {
+    const uint8_t *begin =
+            reinterpret_cast<const uint8_t*> (trace->begin() + trace_offset);
+    const uint8_t *end = reinterpret_cast<const uint8_t*> (trace->end());
+    uint32_t value;
+    const uint8_t *next = DecodeVarint(begin, end, value);
+    if (next == nullptr) {
+        BinaryTraceError();
+    }
+    trace_offset += next - begin;
+    return value;
+}
+
+const char *ProcessTrace::ReadBinaryBytes(size_t count) {
+    if (trace->get_size() - trace_offset < count) {
+        BinaryTraceError();
+    }
+    const char *bytes = trace->begin() + trace_offset;
+    trace_offset += count;
+    return bytes;
+}
+
+ProcessTrace::CmdStatus ProcessTrace::OutOfFramesError(void) {
+    error_message = "ERROR: out of page frames at line "
+            + std::to_string(line_number) + " of " + file_name + "\n";
+    return kCmdFatal;
+}
+
+void ProcessTrace::BinaryTraceError(void) {
+    error_message = "ERROR: invalid binary trace file: " + file_name
+            + " after line " + std::to_string(line_number) + "\n";
+    throw BinaryTraceException();
 }
 
-void ProcessTrace::CmdQuota(const std::string& line,
-        const std::string& cmd,
-        const std::vector<uint32_t>& cmdArgs) {
+ProcessTrace::CmdStatus ProcessTrace::CmdComment(string_view line,
+        const vector<uint32_t> &cmdArgs) {
+    return kCmdOk; // comments are only echoed
+}
+
+ProcessTrace::CmdStatus ProcessTrace::CmdQuota(string_view line,
+        const vector<uint32_t> &cmdArgs) {
     QUOTA = cmdArgs.at(0);
+    return kCmdOk;
 }
 
-void ProcessTrace::CmdCompare(const string &line,
-        const string &cmd,
+ProcessTrace::CmdStatus ProcessTrace::CmdCompare(string_view line,
         const vector<uint32_t> &cmdArgs) {
     uint32_t addr = cmdArgs.at(0);
+    Addr num_bytes = cmd_bytes.size();
+
+    // A compare larger than the scratch arena is done in pieces, so first
+    // make sure the whole range can be read
+    if (num_bytes > kScratchLimit) {
+        Addr readable = ReadableBytes(addr, num_bytes);
+        if (readable < num_bytes) {
+            ReplayReadFault(addr + readable, "PageFaultException");
+            return kCmdOk;
+        }
+    }
 
-    // Compare specified byte values
-    size_t num_bytes = cmdArgs.size() - 1;
-    uint8_t buffer[num_bytes];
+    // Compare specified byte values. The compare runs between stops: where
+    // the bytes of a line of a batch (see GatherBatch) begin, so each line
+    // is echoed before its errors, and at each wide value, which is always
+    // an error.
     try {
-        memory.get_bytes(buffer, addr, num_bytes);
-        for (int i = 1; i < cmdArgs.size(); ++i) {
-            if (buffer[i - 1] != cmdArgs.at(i)) {
-                cout << "compare error at address " << std::hex << addr
-                        << ", expected " << static_cast<uint32_t> (cmdArgs.at(i))
-                        << ", actual is " << static_cast<uint32_t> (buffer[i - 1]) << "\n";
+        auto batch = batch_lines.begin();
+        auto wide = wide_values.begin();
+        for (Addr done = 0; done < num_bytes; ) {
+            Addr chunk = std::min(num_bytes - done, kScratchLimit);
+            UnpinPages();
+            PrepareRange(addr + done, chunk, false);
+            uint8_t *buffer = GetScratch(chunk);
+            memory.get_bytes(buffer, addr + done, chunk);
+            bytes_moved += chunk;
+            const uint8_t *expected = cmd_bytes.data() + done;
+            auto report = [&](Addr i, uint32_t value) {
+                output.Append("compare error at address ");
+                output.AppendHex(addr + done + i);
+                output.Append(", expected ");
+                output.AppendHex(value);
+                output.Append(", actual is ");
+                output.AppendHex(buffer[i]);
+                output.Append('\n');
+            };
+            for (Addr i = 0; i < chunk; ) {
+                Addr limit = chunk;
+                if (batch != batch_lines.end() && batch->offset < done + chunk) {
+                    limit = batch->offset - done;
+                }
+                if (wide != wide_values.end() && wide->first < done + limit) {
+                    limit = wide->first - done;
+                }
+                ForEachMismatch(buffer + i, expected + i, limit - i,
+                        [&](Addr k) { report(i + k, expected[i + k]); });
+                i = limit;
+                if (i == chunk) {
+                    break;
+                }
+                if (batch != batch_lines.end() && batch->offset == done + i) {
+                    ++line_number;
+                    EchoLine(batch->line);
+                    ++batch;
+                } else {
+                    report(i, wide->second);
+                    ++wide;
+                    ++i;
+                }
             }
-            ++addr;
+            done += chunk;
         }
     } catch (PageFaultException e) {
+        ++stats.read_faults;
         PrintAndClearException("PageFaultException", e);
     }
+    return kCmdOk;
 }
 
-bool ProcessTrace::CmdPut(const string &line,
-        const string &cmd,
+ProcessTrace::CmdStatus ProcessTrace::CmdPut(string_view line,
         const vector<uint32_t> &cmdArgs) {
     // Put multiple bytes starting at specified address
     uint32_t addr = cmdArgs.at(0);
-    size_t num_bytes = cmdArgs.size() - 1;
-    uint8_t buffer[num_bytes];
-    int num_pages = (num_bytes + kPageSize - 1) / kPageSize;
-    Addr bytes_written = 0;
-
-    for (int i = 1; i < cmdArgs.size(); ++i) {
-        buffer[i - 1] = cmdArgs.at(i);
-    }
-    bool complete = false;
-    while (!complete) {
-        //clear previous operation of pmcb
-        vmem_pmcb.operation_state = mem::PMCB::NONE;
-        memory.set_PMCB(vmem_pmcb);
-        try {
-            memory.put_bytes(addr, num_bytes, buffer);
-            bytes_written = num_bytes; //all bytes were written successfully
-        } catch (PageFaultException e) {
-            memory.get_PMCB(vmem_pmcb);
-            bytes_written = vmem_pmcb.next_vaddress - addr; //total number of successfully written bytes
-            if (bytes_written != num_bytes) { //need to allocate a page
-                if (allocated_pages == QUOTA) { //check process's quota
-                    return false;
-                } else { 
-                    memory.set_PMCB(pmem_pmcb); //switch to physical mode
-                    AllocateAndMapPage(vmem_pmcb.next_vaddress & mem::kPageNumberMask);
-                    ++allocated_pages;
-                }
-            }
-        } catch (WritePermissionFaultException e) {
-            PrintAndClearException("WritePermissionFaultException", e);
-            complete = true;
-        }
-        if (bytes_written == num_bytes) { //check if command completed
-            complete = true;
-        }
+    Addr num_bytes = cmd_bytes.size();
+
+    // A batch can't fault or exceed the quota (see GatherBatch), so all its
+    // lines are echoed before it is written
+    for (const BatchLine &batch : batch_lines) {
+        ++line_number;
+        EchoLine(batch.line);
     }
-    //make sure the MMU is in virtual mode before returning
-    memory.set_PMCB(vmem_pmcb);
-    return true;
+    return WriteRange(addr, num_bytes,
+            [&](Addr offset, Addr length) -> const uint8_t* {
+                return cmd_bytes.data() + offset;
+            });
 }
 
-bool ProcessTrace::CmdCopy(const string &line,
-        const string &cmd,
+ProcessTrace::CmdStatus ProcessTrace::CmdCopy(string_view line,
         const vector<uint32_t> &cmdArgs) {
     // Copy specified number of bytes to destination from source
     Addr dst = cmdArgs.at(0);
     Addr src = cmdArgs.at(1);
     Addr num_bytes = cmdArgs.at(2);
-    uint8_t buffer[num_bytes];
-    Addr bytes_written = 0;
-    int num_pages = num_bytes / kPageSize;
 
-    // Try reading bytes
-    Addr bytes_read = 0; // number of successfully read bytes
-    try {
-        memory.get_bytes(buffer, src, num_bytes);
-    } catch (PageFaultException e) {
-        PrintAndClearException("PageFaultException on read", e);
+    // Only bytes before the first unreadable source page are copied; the
+    // read fault is reported before anything is written
+    Addr bytes_read = ReadableBytes(src, num_bytes);
+    if (bytes_read < num_bytes) {
+        ReplayReadFault(src + bytes_read, "PageFaultException on read");
     }
-    memory.get_PMCB(vmem_pmcb);
-    bytes_read = vmem_pmcb.next_vaddress - src;
-    
-    // Try writing bytes
-    bool filled = false;
-    while (!filled) {
-        //clear previous operation of pmcb
-        vmem_pmcb.operation_state = mem::PMCB::NONE;
-        memory.set_PMCB(vmem_pmcb);
-        try {
-            memory.put_bytes(dst, bytes_read, buffer);
-            bytes_written = bytes_read; //all bytes written successfully
-        } catch (PageFaultException e) {
-            memory.get_PMCB(vmem_pmcb);
-            bytes_written = vmem_pmcb.next_vaddress - dst; //total number of successfully written bytes
-            if (bytes_written != bytes_read) { //check if need to allocate a page frame
-                if (allocated_pages == QUOTA) { //check process's quota
-                    return false;
-                } else {
-                    //switch to physical mode for allocation
-                    memory.set_PMCB(pmem_pmcb);
-                    AllocateAndMapPage(vmem_pmcb.next_vaddress & mem::kPageNumberMask);
-                    ++allocated_pages;
-                }
-            }
-        } catch (WritePermissionFaultException e) {
-            PrintAndClearException("WritePermissionFaultException", e);
-            filled = true;
+
+    // Copy frame to frame in physical mode, one piece at a time. Pieces end
+    // at source and destination page boundaries.
+    uint8_t *buffer = GetScratch(kPageSize);
+    LoadPhysicalPmcb();
+    for (Addr offset = 0; offset < bytes_read; ) {
+        Addr src_vaddr = src + offset;
+        Addr dst_vaddr = dst + offset;
+        Addr dst_offset = dst_vaddr & kPageOffsetMask;
+        Addr chunk = std::min({bytes_read - offset,
+                               kPageSize - (src_vaddr & kPageOffsetMask),
+                               kPageSize - dst_offset});
+
+        // With paging, bring in the pages of this piece only
+        if (page_replacer != nullptr) {
+            UnpinPages();
+            PrepareRange(src_vaddr, chunk, false);
+            PrepareRange(dst_vaddr, chunk, true);
+            LoadPhysicalPmcb();
+        }
+
+        // Translate destination, allocating the page (or if the rest of the
+        // copy covers it, the whole region) if needed
+        if ((dst_vaddr & (kRegionSize - 1)) == 0
+                && bytes_read - offset >= kRegionSize) {
+            MapRegion(dst_vaddr);
         }
-        if (bytes_written == bytes_read) { //check if command completed
-            filled = true;
+        PageTableEntry dst_entry = LookupPte(dst_vaddr);
+        Addr dst_frame;
+        if ((dst_entry & kPTE_PresentMask) == 0) {
+            if (allocated_pages == QUOTA) { //check process's quota
+                LoadVirtualPmcb();
+                return kCmdQuotaExceeded;
+            }
+            // No need to clear a page the copy will completely overwrite
+            bool whole_page = dst_offset == 0 && bytes_read - offset >= kPageSize;
+            dst_frame = AllocateAndMapPage(dst_vaddr & kPageNumberMask, !whole_page);
+            ++allocated_pages;
+        } else if ((dst_entry & kPTE_WritableMask) == 0
+                   && !UnsharePage(dst_vaddr)) {
+            ReplayWriteFault(dst_vaddr);
+            return kCmdOk;
+        } else {
+            dst_frame = LookupPte(dst_vaddr) & kPageNumberMask;
         }
+
+        // Translate source (known to be present) and move the bytes
+        Addr src_frame = LookupPte(src_vaddr) & kPageNumberMask;
+        memory.get_bytes(buffer, src_frame | (src_vaddr & kPageOffsetMask), chunk);
+        memory.put_bytes(dst_frame | dst_offset, chunk, buffer);
+        bytes_moved += chunk;
+        offset += chunk;
     }
+
     //make sure MMU is in virtual mode before returning
-    memory.set_PMCB(vmem_pmcb);
-    return true;
+    LoadVirtualPmcb();
+    return kCmdOk;
 }
 
-bool ProcessTrace::CmdFill(const string &line,
-        const string &cmd,
+ProcessTrace::CmdStatus ProcessTrace::CmdFill(string_view line,
         const vector<uint32_t> &cmdArgs) {
     // Fill a sequence of bytes with the specified value
     Addr addr = cmdArgs.at(0);
     Addr num_bytes = cmdArgs.at(1);
     uint8_t val = cmdArgs.at(2);
-    Addr bytes_written = 0;
-    Addr starting_addr = cmdArgs.at(0);
-    bool filled = false;
-    while (!filled) {
-        //clear previous operation of pmcb
-        vmem_pmcb.operation_state = mem::PMCB::NONE;
-        memory.set_PMCB(vmem_pmcb);
-        try {
-            int i = bytes_written;
-            for (; i < num_bytes; ++i) {
-                memory.put_byte(addr, &val);
-                ++addr;
-                ++bytes_written;
-            }
-        } catch (PageFaultException e) {
-            memory.get_PMCB(vmem_pmcb);
-            bytes_written = vmem_pmcb.next_vaddress - starting_addr; //total number of bytes written successfully
-            if (bytes_written != num_bytes) { //check if need to allocate a page frame
-                if (allocated_pages == QUOTA) { //check process's quota
-                    return false;
-                } else {
-                    //switch to physical mode for allocation
-                    memory.set_PMCB(pmem_pmcb);
-                    AllocateAndMapPage(vmem_pmcb.next_vaddress & mem::kPageNumberMask);
-                    ++allocated_pages;
-                }
-            }
-        } catch (WritePermissionFaultException e) {
-            PrintAndClearException("WritePermissionFaultException", e);
-            filled = true;
-        }
-        if (bytes_written == num_bytes) { //check if command is completed
-            filled = true;
-        }
-    }
-    //make sure MMU is in virtual mode before returning
-    memory.set_PMCB(vmem_pmcb);
-    return true;
+
+    // Every piece is written from the same buffer of the fill value
+    Addr pattern_bytes = std::min(num_bytes, kScratchLimit);
+    uint8_t *pattern = GetScratch(pattern_bytes);
+    std::fill(pattern, pattern + pattern_bytes, val);
+    return WriteRange(addr, num_bytes,
+            [&](Addr offset, Addr length) -> const uint8_t* {
+                return pattern;
+            });
 }
 
-void ProcessTrace::CmdDump(const string &line,
-        const string &cmd,
+ProcessTrace::CmdStatus ProcessTrace::CmdDump(string_view line,
         const vector<uint32_t> &cmdArgs) {
     uint32_t addr = cmdArgs.at(0);
     uint32_t count = cmdArgs.at(1);
 
     // Output the address
-    cout << std::hex << addr;
+    output.AppendHex(addr);
 
-    // Output the specified number of bytes starting at the address
+    // Output the specified number of bytes starting at the address, 16 bytes
+    // per line. Bytes are read in pieces which don't cross a page boundary,
+    // so a page fault occurs before any byte of a piece is read.
     try {
-        for (int i = 0; i < count; ++i) {
-            if ((i % 16) == 0) { // line break every 16 bytes
-                cout << "\n";
+        uint8_t row[16];
+        for (uint32_t i = 0; i < count; ) {
+            output.Append('\n');
+            uint32_t row_end = std::min(count, i + 16);
+            while (i < row_end) {
+                uint32_t chunk = std::min(row_end - i,
+                        kPageSize - (addr & kPageOffsetMask));
+                UnpinPages();
+                PrepareRange(addr, chunk, false);
+                memory.get_bytes(row, addr, chunk);
+                bytes_moved += chunk;
+                output.AppendDumpBytes(row, chunk);
+                addr += chunk;
+                i += chunk;
             }
-            uint8_t byte_val;
-            memory.get_byte(&byte_val, addr++);
-            cout << " " << std::setfill('0') << std::setw(2)
-                    << static_cast<uint32_t> (byte_val);
         }
-        cout << "\n";
+        output.Append('\n');
     } catch (PageFaultException e) {
-        cout << "\n";
+        ++stats.read_faults;
+        output.Append('\n');
         PrintAndClearException("PageFaultException", e);
     }
+    return kCmdOk;
 }
 
-void ProcessTrace::CmdWritable(const string &line,
-        const string &cmd,
+ProcessTrace::CmdStatus ProcessTrace::CmdWritable(string_view line,
         const vector<uint32_t> &cmdArgs) {
     // Get arguments
     Addr vaddr = cmdArgs.at(0);
     int count = cmdArgs.at(1) / kPageSize;
     bool writable = cmdArgs.at(2) != 0;
 
-    // Switch to physical mode
-    memory.get_PMCB(vmem_pmcb);
-    memory.set_PMCB(pmem_pmcb);
-
-    Addr pt_base = vmem_pmcb.page_table_base;
-
-    // Modify pages in range
+    // Modify pages in range (switching to physical mode if any changes)
     while (count-- > 0) {
         SetWritableStatus(vaddr, writable);
         vaddr += 0x1000;
     }
 
     // Switch back to virtual mode
-    memory.set_PMCB(vmem_pmcb);
+    LoadVirtualPmcb();
+    return kCmdOk;
+}
+
+ProcessTrace::CmdStatus ProcessTrace::CmdInvalid(string_view line,
+        const vector<uint32_t> &cmdArgs) {
+    error_message = "ERROR: invalid command at line "
+            + std::to_string(line_number) + ":\n" + string(line) + "\n";
+    return kCmdFatal;
 }
 
 void ProcessTrace::PrintAndClearException(const string &type,
         MemorySubsystemException e) {
     memory.get_PMCB(vmem_pmcb);
-    cout << "Exception type " << type
-            << " occurred at input line " << std::dec << std::setw(1)
-            << line_number << " at virtual address 0x"
-            << std::hex << std::setw(8) << std::setfill('0')
-            << vmem_pmcb.next_vaddress
-            << ": " << e.what() << "\n";
+    output.Append("Exception type ");
+    output.Append(type);
+    output.Append(" occurred at input line ");
+    output.AppendDec(line_number);
+    output.Append(" at virtual address 0x");
+    output.AppendHex(vmem_pmcb.next_vaddress, 8);
+    output.Append(": ");
+    output.Append(e.what());
+    output.Append('\n');
     vmem_pmcb.operation_state = PMCB::NONE;
-    memory.set_PMCB(vmem_pmcb);
+    pmcb_tracker.Reload(this, false, vmem_pmcb);
+    ++stats.pmcb_switches;
 }
 
-void ProcessTrace::AllocateAndMapPage(Addr vaddr) {
-    // Get offset in L1 table of L2 entry for vaddr  
-    Addr pt_base = vmem_pmcb.page_table_base;
-    Addr pt_l1_offset = vaddr >> (kPageSizeBits + kPageTableSizeBits);
+void ProcessTrace::EchoLine(string_view line) {
+    output.AppendDec(line_number);
+    output.Append(':');
+    output.AppendDec(id_number);
+    output.Append(':');
+    output.Append(line);
+    output.Append('\n');
+}
 
-    // Get L1 page table entry
-    Addr l1_entry_addr = pt_base + sizeof (PageTableEntry) * pt_l1_offset;
-    PageTableEntry l1_entry;
-    memory.get_bytes(reinterpret_cast<uint8_t*> (&l1_entry),
-            l1_entry_addr, sizeof (PageTableEntry));
-
-    // If no L1 entry for page, allocate and map one
-    if ((l1_entry & kPTE_PresentMask) == 0) {
-        vector<Addr> allocated;
-        allocator.Allocate(1, allocated);
-        l1_entry = allocated[0] | kPTE_PresentMask | kPTE_WritableMask;
-        memory.put_bytes(l1_entry_addr, sizeof (PageTableEntry),
-                reinterpret_cast<uint8_t*> (&l1_entry));
+void ProcessTrace::PrintQuotaExceeded(void) {
+    output.Append("ERROR: memory quota ");
+    output.AppendHex(QUOTA);
+    output.Append(" exceeded\n");
+}
+
+ProcessTrace::CmdStatus ProcessTrace::WriteRange(Addr addr, Addr count,
+        const ChunkSource &source) {
+    // With paging the range is done in pieces ending at page boundaries, each
+    // mapped and written before the next is swapped in, so it may cover more
+    // pages than fit in memory. Otherwise the whole range is one piece.
+    for (Addr done = 0; done < count; ) {
+        Addr piece_addr = addr + done;
+        Addr piece_count = page_replacer == nullptr ? count
+                : std::min(count - done,
+                           kScratchLimit - (piece_addr & kPageOffsetMask));
+        ChunkSource piece_source = [&source, done](Addr offset, Addr length) {
+            return source(done + offset, length);
+        };
+        UnpinPages();
+        PrepareRange(piece_addr, piece_count, true);
+
+        // Allocate destination pages up front; if the quota is exceeded, only
+        // the bytes before the first page which couldn't be allocated are
+        // written
+        Addr mapped_bytes;
+        bool within_quota = MapRange(piece_addr, piece_count, piece_source,
+                                     mapped_bytes);
+        Addr write_bytes = within_quota ? piece_count : mapped_bytes;
+
+        // Write the bytes, except in pages MapRange already wrote
+        LoadVirtualPmcb();
+        try {
+            auto shared = shared_written.begin();
+            for (Addr offset = 0; offset < write_bytes; ) {
+                if (shared != shared_written.end()
+                        && piece_addr + offset == *shared) {
+                    bytes_moved += kPageSize;
+                    offset += kPageSize;
+                    ++shared;
+                    continue;
+                }
+                Addr chunk = std::min(write_bytes - offset, kScratchLimit);
+                if (shared != shared_written.end()) {
+                    chunk = std::min(chunk, *shared - (piece_addr + offset));
+                }
+                memory.put_bytes(piece_addr + offset, chunk,
+                        const_cast<uint8_t*> (piece_source(offset, chunk)));
+                bytes_moved += chunk;
+                offset += chunk;
+            }
+        } catch (WritePermissionFaultException e) {
+            ++stats.write_faults;
+            PrintAndClearException("WritePermissionFaultException", e);
+            return kCmdOk;
+        }
+        if (!within_quota) {
+            return kCmdQuotaExceeded;
+        }
+        done += piece_count;
     }
+    return kCmdOk;
+}
 
-    // Get L2 page table entry
-    Addr pt_l2_addr = l1_entry & kPageNumberMask;
-    Addr pt_l2_offset = (vaddr >> kPageSizeBits) & kPageTableIndexMask;
-    Addr l2_entry_addr = pt_l2_addr + sizeof (PageTableEntry) * pt_l2_offset;
-    PageTableEntry l2_entry;
-    memory.get_bytes(reinterpret_cast<uint8_t*> (&l2_entry),
-            l2_entry_addr, sizeof (PageTableEntry));
+Addr ProcessTrace::ReadableBytes(Addr addr, Addr count) {
+    Addr readable = 0;
+    while (readable < count) {
+        Addr page_offset = (addr + readable) & kPageOffsetMask;
+        Addr vaddr = (addr + readable) & kPageNumberMask;
+
+        // Stop at first page which is not present (or in swap)
+        if ((LookupPte(vaddr) & kPTE_PresentMask) == 0
+                && (swapped_pages.empty() || swapped_pages.count(vaddr) == 0)) {
+            break;
+        }
+        readable += std::min(count - readable, kPageSize - page_offset);
+    }
+    return readable;
+}
+
+void ProcessTrace::ReplayReadFault(Addr vaddr, const string &type) {
+    // Read the byte to get the MMU's exception for the access
+    try {
+        uint8_t byte_val;
+        memory.get_byte(&byte_val, vaddr);
+    } catch (PageFaultException e) {
+        ++stats.read_faults;
+        PrintAndClearException(type, e);
+    }
+}
+
+void ProcessTrace::ReplayWriteFault(Addr vaddr) {
+    // Write the byte to get the MMU's exception for the access; the write
+    // faults before anything is stored
+    LoadVirtualPmcb();
+    try {
+        uint8_t byte_val = 0;
+        memory.put_byte(vaddr, &byte_val);
+    } catch (WritePermissionFaultException e) {
+        ++stats.write_faults;
+        PrintAndClearException("WritePermissionFaultException", e);
+    }
+}
+
+void ProcessTrace::LoadVirtualPmcb(void) {
+    if (pmcb_tracker.Load(this, false, vmem_pmcb)) {
+        ++stats.pmcb_switches;
+    }
+}
+
+void ProcessTrace::LoadPhysicalPmcb(void) {
+    if (pmcb_tracker.Load(this, true, kPhysicalPmcb)) {
+        ++stats.pmcb_switches;
+    }
+}
+
+uint8_t *ProcessTrace::GetScratch(Addr bytes) {
+    if (scratch.size() < bytes) {
+        scratch.resize(std::min(bytes, kScratchLimit));
+    }
+    return scratch.data();
+}
+
+bool ProcessTrace::MapRange(Addr addr, Addr count, const ChunkSource &source,
+        Addr &mapped_bytes) {
+    mapped_bytes = 0;
+    shared_written.clear();
+    bool within_quota = true;
+    while (mapped_bytes < count) {
+        Addr page_offset = (addr + mapped_bytes) & kPageOffsetMask;
+        Addr page_bytes = std::min(count - mapped_bytes, kPageSize - page_offset);
+        Addr vaddr = (addr + mapped_bytes) & kPageNumberMask;
+
+        // Map a whole region the range covers at once if possible
+        if ((vaddr & (kRegionSize - 1)) == 0 && page_offset == 0
+                && count - mapped_bytes >= kRegionSize) {
+            if (MapRegion(vaddr)) {
+                mapped_bytes += kRegionSize;
+                continue;
+            }
+        }
+
+        PageTableEntry l2_entry = LookupPte(vaddr);
+        bool whole_page = page_bytes == kPageSize;
+        if ((l2_entry & kPTE_PresentMask) != 0) {
+            if ((l2_entry & kPTE_WritableMask) == 0) {
+                const ShadowTable &table = *shadow_tables[
+                        vaddr >> (kPageSizeBits + kPageTableSizeBits)];
+                Addr index = (vaddr >> kPageSizeBits) & kPageTableIndexMask;
+                if (whole_page && table.shared[index]
+                        && table.shared_writable[index]) {
+                    // Share the new contents instead of copying the old
+                    LoadPhysicalPmcb();
+                    MapSharedPage(vaddr, source(mapped_bytes, kPageSize));
+                    shared_written.push_back(vaddr);
+                } else if (!UnsharePage(vaddr)) {
+                    break; // write will fault here; later pages are not needed
+                }
+            }
+        } else if (allocated_pages == QUOTA) { //check process's quota
+            within_quota = false;
+            break;
+        } else if (page_sharing != nullptr && whole_page) {
+            LoadPhysicalPmcb();
+            MapSharedPage(vaddr, source(mapped_bytes, kPageSize));
+            shared_written.push_back(vaddr);
+            ++allocated_pages;
+        } else {
+            // A page that will be completely overwritten need not be cleared.
+            // Only allocation needs physical mode; lookups use the shadow.
+            LoadPhysicalPmcb();
+            AllocateAndMapPage(vaddr, !whole_page);
+            ++allocated_pages;
+        }
+        mapped_bytes += page_bytes;
+    }
+
+    LoadVirtualPmcb(); //back to virtual mode
+    return within_quota;
+}
+
+Addr ProcessTrace::AllocateAndMapPage(Addr vaddr, bool clear) {
+    LatencyTimer timer(stats.map_page_latency);
+    ShadowTable &table = GetShadowTable(vaddr);
 
     // Error if page already allocated
-    if ((l2_entry & kPTE_PresentMask) != 0) {
+    if ((LookupPte(vaddr) & kPTE_PresentMask) != 0) {
         cerr << "ERROR: duplicate allocated at vaddr = 0x"
                 << std::hex << vaddr << "\n";
         throw std::bad_alloc();
     }
 
     // Allocate a page and set up page table entry
+    Addr frame = AllocateFrame(clear);
+    ++stats.page_faults;
+    if (page_replacer != nullptr) {
+        page_replacer->Add(frame, this, vaddr, SwapStore::kNoSlot, true);
+    }
+    StorePte(table, vaddr, frame | kPTE_PresentMask | kPTE_WritableMask);
+    return frame;
+}
+
+bool ProcessTrace::MapRegion(Addr vaddr) {
+    if (!huge_pages || page_sharing != nullptr
+            || shadow_tables[vaddr >> (kPageSizeBits + kPageTableSizeBits)]
+            || allocated_pages + static_cast<int> (kPageTableEntries) > QUOTA) {
+        return false;
+    }
+
+    // Allocate the L2 table first; if there is no run of frames it is used
+    // for mapping the pages singly
+    LoadPhysicalPmcb();
+    ShadowTable &table = GetShadowTable(vaddr);
+    Addr base;
+    if (!allocator.AllocateContiguous(kPageTableSizeBits, base, false)) {
+        return false;
+    }
+    table.region_block = true;
+    for (Addr i = 0; i < kPageTableEntries; ++i) {
+        Addr frame = base + i * kPageSize;
+        table.entries[i] = frame | kPTE_PresentMask | kPTE_WritableMask;
+        if (page_replacer != nullptr) {
+            page_replacer->Add(frame, this, vaddr + i * kPageSize,
+                               SwapStore::kNoSlot, true);
+        }
+    }
+    memory.put_bytes(table.frame, kPageTableSizeBytes,
+            reinterpret_cast<uint8_t*> (table.entries.data()));
+    allocated_pages += kPageTableEntries;
+    stats.page_faults += kPageTableEntries;
+    ++stats.regions_mapped;
+    return true;
+}
+
+Addr ProcessTrace::AllocateFrame(bool clear) {
     vector<Addr> allocated;
-    allocator.Allocate(1, allocated);
-    l2_entry = allocated[0] | kPTE_PresentMask | kPTE_WritableMask;
-    memory.put_bytes(l2_entry_addr, sizeof (PageTableEntry),
-            reinterpret_cast<uint8_t*> (&l2_entry));
+    while (!allocator.Allocate(1, allocated, clear)) {
+        if (page_replacer == nullptr || !page_replacer->Evict()) {
+            throw OutOfFramesException();
+        }
+    }
+    return allocated[0];
 }
 
-void ProcessTrace::SetWritableStatus(Addr vaddr, bool writable) {
-    // Get offset in L1 table of L2 entry for vaddr  
-    Addr pt_base = vmem_pmcb.page_table_base;
+void ProcessTrace::ReserveFrame(void) {
+    if (allocator.get_page_frames_free() == 0
+            && (page_replacer == nullptr || !page_replacer->Evict())) {
+        throw OutOfFramesException();
+    }
+}
+
+void ProcessTrace::PrepareRange(Addr addr, Addr count, bool write) {
+    if (page_replacer == nullptr || count == 0) {
+        return;
+    }
+    bool swapped_in = false;
+    Addr last = (addr + count - 1) & kPageNumberMask;
+    for (Addr vaddr = addr & kPageNumberMask; ; vaddr += kPageSize) {
+        PageTableEntry entry = LookupPte(vaddr);
+        if ((entry & kPTE_PresentMask) == 0 && !swapped_pages.empty()) {
+            auto swapped = swapped_pages.find(vaddr);
+            if (swapped != swapped_pages.end()) {
+                SwapInPage(vaddr, swapped);
+                swapped_in = true;
+                entry = LookupPte(vaddr);
+            }
+        }
+        if ((entry & kPTE_PresentMask) != 0) {
+            page_replacer->Reference(entry & kPageNumberMask, write);
+        } else if (!write) {
+            break; // the read faults here
+        }
+        if (vaddr == last) {
+            break;
+        }
+    }
+    if (swapped_in) {
+        LoadVirtualPmcb();
+    }
+}
+
+void ProcessTrace::SwapInPage(Addr vaddr,
+        std::unordered_map<Addr, SwapEntry>::iterator entry) {
+    // Remove the entry first: making room may evict other pages
+    SwapEntry swapped = entry->second;
+    swapped_pages.erase(entry);
+    LoadPhysicalPmcb();
+    Addr frame = AllocateFrame(false);
+    page_replacer->ReadSlot(swapped.slot, frame);
+    page_replacer->Add(frame, this, vaddr, swapped.slot, false);
+    ++stats.swap_ins;
+    StorePte(*shadow_tables[vaddr >> (kPageSizeBits + kPageTableSizeBits)],
+            vaddr, frame | kPTE_PresentMask
+                   | (swapped.writable ? kPTE_WritableMask : 0));
+}
+
+void ProcessTrace::PageEvicted(Addr vaddr, uint32_t slot, bool written) {
+    ShadowTable &table = *shadow_tables[vaddr >> (kPageSizeBits + kPageTableSizeBits)];
+    bool writable = (LookupPte(vaddr) & kPTE_WritableMask) != 0;
+    swapped_pages[vaddr] = SwapEntry{slot, writable};
+    StorePte(table, vaddr, 0);
+    ++stats.swap_outs;
+    if (written) {
+        ++stats.swap_writes;
+    }
+}
+
+void ProcessTrace::SaveState(CheckpointWriter &out) {
+    out.Put<uint64_t>(trace_offset);
+    out.Put<int64_t>(line_number);
+    out.Put<int32_t>(allocated_pages);
+    out.Put<int32_t>(QUOTA);
+    out.Put(vmem_pmcb);
+    out.Put(stats);
+
+    // Frame addresses and the L2 tables mapping a region block, then the
+    // frames, page aligned in the file
+    vector<Addr> frames(owned_frames);
+    std::bitset<kPageTableEntries> region_blocks;
+    for (Addr l1 = 0; l1 < kPageTableEntries; ++l1) {
+        const std::unique_ptr<ShadowTable> &table = shadow_tables[l1];
+        for (Addr i = 0; table && i < kPageTableEntries; ++i) {
+            if ((table->entries[i] & kPTE_PresentMask) != 0) {
+                frames.push_back(table->entries[i] & kPageNumberMask);
+            }
+        }
+        region_blocks[l1] = table && table->region_block;
+    }
+    out.Put<uint64_t>(owned_frames.size());
+    out.Put<uint64_t>(frames.size());
+    out.PutBytes(frames.data(), frames.size() * sizeof (Addr));
+    out.Put(region_blocks);
+    out.Align(kPageSize);
+    pmcb_tracker.Load(this, true, kPhysicalPmcb);
+    uint8_t *page = GetScratch(kPageSize);
+    for (Addr frame : frames) {
+        memory.get_bytes(page, frame, kPageSize);
+        out.PutBytes(page, kPageSize);
+    }
+}
+
+void ProcessTrace::RestoreState(CheckpointReader &in) {
+    trace_offset = in.Get<uint64_t>();
+    line_number = in.Get<int64_t>();
+    allocated_pages = in.Get<int32_t>();
+    QUOTA = in.Get<int32_t>();
+    vmem_pmcb = in.Get<PMCB>();
+    stats = in.Get<ProcessStats>();
+    if (trace_offset > trace->get_size() || stats.id != id_number) {
+        in.Mismatch("position in trace " + file_name);
+    }
+
+    // Write back the frames
+    uint64_t table_frames = in.Get<uint64_t>();
+    vector<Addr> frames(in.Get<uint64_t>());
+    if (table_frames > frames.size()) {
+        in.Mismatch("page tables of trace " + file_name);
+    }
+    std::memcpy(frames.data(), in.GetBytes(frames.size() * sizeof (Addr)),
+                frames.size() * sizeof (Addr));
+    std::bitset<kPageTableEntries> region_blocks
+            = in.Get<std::bitset<kPageTableEntries>>();
+    in.Align(kPageSize);
+    const uint8_t *pages = in.GetBytes(frames.size() * kPageSize);
+    pmcb_tracker.Load(this, true, kPhysicalPmcb);
+    for (size_t i = 0; i < frames.size(); ++i) {
+        memory.put_bytes(frames[i], kPageSize, pages + i * kPageSize);
+    }
+    owned_frames.assign(frames.begin(), frames.begin() + table_frames);
+    if (owned_frames.empty()) {
+        if (region_blocks.any()) {
+            in.Mismatch("page tables of trace " + file_name);
+        }
+        return; //hadn't run yet
+    }
+
+    // Rebuild the shadow of each L2 table the L1 table maps
+    std::array<PageTableEntry, kPageTableEntries> l1_table;
+    memory.get_bytes(reinterpret_cast<uint8_t*> (l1_table.data()),
+                     vmem_pmcb.page_table_base, kPageSize);
+    for (Addr i = 0; i < kPageTableEntries; ++i) {
+        if ((l1_table[i] & kPTE_PresentMask) == 0) {
+            if (region_blocks[i]) {
+                in.Mismatch("page tables of trace " + file_name);
+            }
+            continue;
+        }
+        std::unique_ptr<ShadowTable> &table = shadow_tables[i];
+        table.reset(new ShadowTable);
+        table->frame = l1_table[i] & kPageNumberMask;
+        memory.get_bytes(reinterpret_cast<uint8_t*> (table->entries.data()),
+                         table->frame, kPageSize);
+        table->region_block = region_blocks[i];
+    }
+}
+
+ProcessTrace::ShadowTable &ProcessTrace::GetShadowTable(Addr vaddr) {
     Addr pt_l1_offset = vaddr >> (kPageSizeBits + kPageTableSizeBits);
+    std::unique_ptr<ShadowTable> &table = shadow_tables[pt_l1_offset];
+    if (!table) {
+        // No L1 entry for page, allocate an L2 table (cleared, like its
+        // shadow) and map it
+        Addr l1_entry_addr = vmem_pmcb.page_table_base
+                + sizeof (PageTableEntry) * pt_l1_offset;
+        Addr frame = AllocateFrame(true);
+        owned_frames.push_back(frame);
+        PageTableEntry l1_entry = frame | kPTE_PresentMask | kPTE_WritableMask;
+        memory.put_bytes(l1_entry_addr, sizeof (PageTableEntry),
+                reinterpret_cast<uint8_t*> (&l1_entry));
+        table.reset(new ShadowTable);
+        table->frame = frame;
+        table->entries.fill(0);
+    }
+    return *table;
+}
 
-    // Get L1 page table entry
-    Addr l1_entry_addr = pt_base + sizeof (PageTableEntry) * pt_l1_offset;
-    PageTableEntry l1_entry;
-    memory.get_bytes(reinterpret_cast<uint8_t*> (&l1_entry),
-            l1_entry_addr, sizeof (PageTableEntry));
+void ProcessTrace::MapSharedPage(Addr vaddr, const uint8_t *contents) {
+    ShadowTable &table = GetShadowTable(vaddr);
+    Addr index = (vaddr >> kPageSizeBits) & kPageTableIndexMask;
+    PageTableEntry old_entry = table.entries[index];
+    if ((old_entry & kPTE_PresentMask) == 0) {
+        ++stats.page_faults;
+        table.shared_writable[index] = true;
+    }
 
-    // If no L1 entry for page, ignore request
-    if ((l1_entry & kPTE_PresentMask) == 0) {
-        return;
+    // Take the new reference before dropping the old one, which may be to
+    // the same frame
+    Addr frame;
+    ReserveFrame();
+    page_sharing->Share(contents, frame);
+    ++stats.shared_pages;
+    if (table.shared[index]) {
+        page_sharing->Release(old_entry & kPageNumberMask);
     }
+    table.shared[index] = true;
+    StorePte(table, vaddr, frame | kPTE_PresentMask);
+}
 
-    // Get L2 page table entry
-    Addr pt_l2_addr = l1_entry & kPageNumberMask;
-    Addr pt_l2_offset = (vaddr >> kPageSizeBits) & kPageTableIndexMask;
-    Addr l2_entry_addr = pt_l2_addr + sizeof (PageTableEntry) * pt_l2_offset;
-    PageTableEntry l2_entry;
-    memory.get_bytes(reinterpret_cast<uint8_t*> (&l2_entry),
-            l2_entry_addr, sizeof (PageTableEntry));
+bool ProcessTrace::UnsharePage(Addr vaddr) {
+    ShadowTable *table = shadow_tables[
+            vaddr >> (kPageSizeBits + kPageTableSizeBits)].get();
+    Addr index = (vaddr >> kPageSizeBits) & kPageTableIndexMask;
+    if (table == nullptr || !table->shared[index]
+            || !table->shared_writable[index]) {
+        return false;
+    }
+
+    LoadPhysicalPmcb();
+    Addr frame = table->entries[index] & kPageNumberMask;
+    if (!page_sharing->TakePrivate(frame)) {
+        // Copy on write
+        uint8_t contents[kPageSize];
+        memory.get_bytes(contents, frame, kPageSize);
+        page_sharing->Release(frame);
+        frame = AllocateFrame(false);
+        memory.put_bytes(frame, kPageSize, contents);
+        ++stats.cow_copies;
+    }
+    if (page_replacer != nullptr) {
+        page_replacer->Add(frame, this, vaddr & kPageNumberMask,
+                           SwapStore::kNoSlot, true);
+    }
+    table->shared[index] = false;
+    table->shared_writable[index] = false;
+    StorePte(*table, vaddr, frame | kPTE_PresentMask | kPTE_WritableMask);
+    return true;
+}
 
-    // Ignore request if page not present
+void ProcessTrace::SetWritableStatus(Addr vaddr, bool writable) {
+    // Ignore request if page not present (or no L2 table for page); a page
+    // in swap gets the status when swapped in
+    PageTableEntry l2_entry = LookupPte(vaddr);
     if ((l2_entry & kPTE_PresentMask) == 0) {
+        if (!swapped_pages.empty()) {
+            auto swapped = swapped_pages.find(vaddr);
+            if (swapped != swapped_pages.end()) {
+                swapped->second.writable = writable;
+            }
+        }
         return;
     }
 
-    // Set status to requested value and rewrite entry
-    l2_entry = (l2_entry & ~kPTE_WritableMask) | (writable ? kPTE_WritableMask : 0);
-    memory.put_bytes(l2_entry_addr, sizeof (PageTableEntry),
-            reinterpret_cast<uint8_t*> (&l2_entry));
+    // A shared page stays read-only in the page table until written
+    ShadowTable &table = *shadow_tables[vaddr >> (kPageSizeBits + kPageTableSizeBits)];
+    Addr index = (vaddr >> kPageSizeBits) & kPageTableIndexMask;
+    if (table.shared[index]) {
+        table.shared_writable[index] = writable;
+        return;
+    }
+
+    // Set status to requested value and rewrite entry if changed
+    PageTableEntry new_entry = (l2_entry & ~kPTE_WritableMask)
+            | (writable ? kPTE_WritableMask : 0);
+    if (new_entry == l2_entry) {
+        return;
+    }
+    LoadPhysicalPmcb();
+    StorePte(table, vaddr, new_entry);
+}
+
+void ProcessTrace::StorePte(ShadowTable &table, Addr vaddr,
+        PageTableEntry entry) {
+    Addr pt_l2_offset = (vaddr >> kPageSizeBits) & kPageTableIndexMask;
+    table.entries[pt_l2_offset] = entry;
+    memory.put_bytes(table.frame + sizeof (PageTableEntry) * pt_l2_offset,
+            sizeof (PageTableEntry), reinterpret_cast<uint8_t*> (&entry));
 }
@@ -71,6 +71,18 @@
  * The # character in the first column means the remainder of the line should 
  * be treated as a comment. The command should be echoed to output in the same 
  * way as other commands, but should otherwise be ignored.
+ * 
+ * Binary Traces
+ * A trace file may instead be in the pre-compiled binary format described in
+ * TraceFormat.h (see TraceCompiler). The format is detected when the file is
+ * opened; binary records are decoded without any text parsing, and produce
+ * exactly the same output as the text trace they were compiled from.
+ * 
+ * Batching
+ * A run of put (or compare) records to contiguous addresses is executed as
+ * one range operation when none of its records can fault or exceed the quota
+ * (see GatherBatch), within the time slice. Lines are still echoed, and
+ * compare errors reported, in trace order.
  */
 
 /* 
@@ -82,28 +94,66 @@
 #ifndef PROCESSTRACE_H
 #define PROCESSTRACE_H
 
+#include "Checkpoint.h"
+#include "OutputBuffer.h"
 #include "PageFrameAllocator.h"
+#include "PageReplacer.h"
+#include "PageSharing.h"
+#include "PmcbTracker.h"
+#include "RunQueue.h"
+#include "SimulatorStats.h"
+#include "TraceFile.h"
+#include "TraceFormat.h"
+#include "TracePrefetcher.h"
 
 #include <MMU.h>
 
-#include <fstream>
+#include <array>
+#include <bitset>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-class ProcessTrace {
+class ProcessTrace : public RunQueueNode {
 public:
   /**
-   * Constructor - open trace file, initialize processing
+   * Constructor - map trace file, initialize processing
    * 
    * @param memory_ MMU to use for memory
+   * @param allocator page frame allocator for the process's pages
+   * @param pmcb_tracker_ tracker of the PMCB loaded in memory_
    * @param file_name_ source of trace commands
+   * @param id process number
+   */
+  ProcessTrace(mem::MMU &memory_,
+               PageFrameAllocator &allocator,
+               PmcbTracker &pmcb_tracker_,
+               std::string file_name_, int id);
+  
+  /**
+   * Constructor - initialize processing of a trace file which is already
+   *   mapped
+   * 
+   * @param memory_ MMU to use for memory
+   * @param allocator page frame allocator for the process's pages
+   * @param pmcb_tracker_ tracker of the PMCB loaded in memory_
+   * @param trace_ mapped trace file
+   * @param file_name_ name of trace file (for error messages)
+   * @param id process number
    */
   ProcessTrace(mem::MMU &memory_,
                PageFrameAllocator &allocator,
+               PmcbTracker &pmcb_tracker_,
+               std::shared_ptr<TraceFile> trace_,
                std::string file_name_, int id);
   
   /**
-   * Destructor - close trace file, clean up processing
+   * Destructor - release trace file mapping, return all page frames owned
+   *   by the process (page tables and data pages) to the allocator
    */
   virtual ~ProcessTrace(void);
 
@@ -114,17 +164,132 @@ public:
   ProcessTrace operator=(ProcessTrace &&other) = delete;
   
   /**
-   * Execute - read and process commands from trace file
+   * Execute - read and process commands from trace file. Output is
+   *   accumulated in the process output buffer (see GetOutput).
    * 
+   * @param num_lines maximum number of lines to execute
+   * @return number of lines executed; less than num_lines if the process
+   *   terminated (end of trace, quota exceeded, or a fatal error in the
+   *   trace, see GetErrorMessage)
    */
   int Execute(int num_lines);
+  
+  /**
+   * GetOutput - output produced by the process which has not yet been
+   *   written to the output sink
+   */
+  OutputBuffer &GetOutput(void) { return output; }
+  
+  /**
+   * GetErrorMessage - description of a fatal error in the trace, to be
+   *   written to standard error before the program exits. Empty unless
+   *   Execute stopped because of an invalid trace, or because no page frame
+   *   could be had for it.
+   */
+  const std::string &GetErrorMessage(void) const { return error_message; }
   int getID(){ return id_number; }
   int getLinesExecuted(){ return line_number; }
+  int get_allocated_pages(void) const { return allocated_pages; }
+  
+  /**
+   * GetStats - performance counters of the process
+   */
+  const ProcessStats &GetStats(void) const { return stats; }
+  
+  /**
+   * set_timing - measure wall and CPU time of each time slice (Execute
+   *   call). Off by default, since reading the CPU clock is a system call.
+   */
+  void set_timing(bool timing_) { timing = timing_; }
+  
+  /**
+   * set_page_sharing - share the frames of identical pages written whole
+   *   through a registry (see PageSharing.h), or not if null (the default).
+   *   Must be set before the process runs.
+   */
+  void set_page_sharing(PageSharing *page_sharing_) {
+    page_sharing = page_sharing_;
+  }
+  
+  /**
+   * set_huge_pages - map a missing 4 MiB region (the pages of one L2 table)
+   *   in one pass when a write covers all of it; off by default. See
+   *   MapRegion.
+   */
+  void set_huge_pages(bool huge_pages_) { huge_pages = huge_pages_; }
+  
+  /**
+   * set_page_replacer - when page frames run out, evict pages to swap
+   *   through the replacer of the process's memory (see PageReplacer.h), or
+   *   stop with a fatal error if null (the default). Must be set before the
+   *   process runs.
+   */
+  void set_page_replacer(PageReplacer *page_replacer_) {
+    page_replacer = page_replacer_;
+  }
+  
+  /**
+   * set_prefetcher - have the trace read ahead of execution by a prefetcher
+   *   (see TracePrefetcher.h); by default it is not. Must be set before the
+   *   process runs.
+   * 
+   * @param prefetcher_ prefetcher reading the trace
+   * @param stream stream of the trace, from prefetcher_->Add; the process
+   *   removes it when destroyed
+   */
+  void set_prefetcher(TracePrefetcher *prefetcher_,
+                      TracePrefetcher::Stream *stream);
+  
+  /**
+   * ReleaseTrace - drop the process's mapping of its trace between time
+   *   slices (the file is unmapped once no other process uses it). The
+   *   position in the trace is kept, and the trace is mapped again when
+   *   the process next runs. Not used with a prefetcher, whose stream keeps
+   *   the trace mapped.
+   */
+  void ReleaseTrace(void) { trace.reset(); }
+  
+  /**
+   * has_trace - true if the process holds a mapping of its trace
+   */
+  bool has_trace(void) const { return trace != nullptr; }
+  
+  /**
+   * PageEvicted - called by the PageReplacer when it evicts a page of the
+   *   process: the page is marked not present, and remembered as swapped
+   *   out. The MMU must be in physical mode.
+   * 
+   * @param vaddr virtual address of page
+   * @param slot swap slot holding the page
+   * @param written true if the page was written to the slot
+   */
+  void PageEvicted(mem::Addr vaddr, uint32_t slot, bool written);
+  
+  /**
+   * SaveState - write the process to a checkpoint between time slices:
+   *   trace position, line number, quota, PMCB, counters, and the contents
+   *   of every page frame it uses (page tables first), and which L2 tables
+   *   map a region as one block (MapRegion). Pages must not be shared or
+   *   swapped out. Switches to physical mode.
+   */
+  void SaveState(CheckpointWriter &out);
+  
+  /**
+   * RestoreState - replace the state of a process which has not run with
+   *   that written by SaveState for the same trace: the saved frames are
+   *   written back to memory (whose allocator must have been restored too)
+   *   and the shadow page table is read back from them. Switches to
+   *   physical mode.
+   */
+  void RestoreState(CheckpointReader &in);
   
 private:
-  // Trace file
+  // Trace file, memory mapped (shared with other processes using the file),
+  // or null while released (see ReleaseTrace)
   std::string file_name;
-  std::fstream trace;
+  std::shared_ptr<TraceFile> trace;
+  size_t trace_offset;  // offset of next line or record in trace
+  bool binary_trace;  // true if trace is in binary format (TraceFormat.h)
   long line_number;
   int id_number;
   int allocated_pages;
@@ -134,58 +299,256 @@ private:
   // Memory contents
   mem::MMU &memory;
   
-  // Virtual and physical mode PMCBs
+  // Virtual and physical mode PMCBs, loaded through the tracker shared by
+  // all processes in memory; physical mode is the same for every process
   mem::PMCB vmem_pmcb;
-  mem::PMCB pmem_pmcb;
+  static const mem::PMCB kPhysicalPmcb;
+  PmcbTracker &pmcb_tracker;
   
   // Memory allocator
   PageFrameAllocator &allocator;
   
+  // Registry of shared frames, or null if pages are not shared
+  PageSharing *page_sharing;
+  
+  // Page replacement for the process's memory, or null if pages are never
+  // evicted
+  PageReplacer *page_replacer;
+  
+  // Prefetcher reading the trace ahead and the process's stream in it, or
+  // null; the position is reported when trace_offset reaches
+  // prefetch_report
+  TracePrefetcher *prefetcher;
+  TracePrefetcher::Stream *prefetch_stream;
+  size_t prefetch_report;
+  
+  // Output of the process, and fatal error message (if any)
+  OutputBuffer output;
+  std::string error_message;
+  
+  // Ledger of the page table frames owned by the process (L1 and L2),
+  // returned to the allocator when the process is destroyed along with the
+  // data pages found in the page table. Empty until the process first runs.
+  std::vector<mem::Addr> owned_frames;
+  
+  // Pages evicted to swap (see PageReplacer), by virtual address. They are
+  // not present in the page table, and are swapped in by PrepareRange
+  // before a command uses them.
+  struct SwapEntry {
+    uint32_t slot;
+    bool writable;
+  };
+  std::unordered_map<mem::Addr, SwapEntry> swapped_pages;
+  
+  // Host shadow of the page table, indexed like the L1 table (null where
+  // there is no L2 table). Every page table entry is written both to the
+  // tables in simulated memory, which the MMU walks, and to the shadow, so
+  // the two always agree; lookups read only the shadow, without the MMU.
+  // A page mapped to a shared frame (PageSharing) is read-only in the page
+  // table; shared_writable holds the writable status the trace gave it.
+  struct ShadowTable {
+    mem::Addr frame;  // physical address of the L2 table
+    std::array<mem::PageTableEntry, mem::kPageTableEntries> entries;
+    std::bitset<mem::kPageTableEntries> shared;
+    std::bitset<mem::kPageTableEntries> shared_writable;
+    bool region_block = false;  // pages mapped to one block (MapRegion)
+  };
+  std::array<std::unique_ptr<ShadowTable>, mem::kPageTableEntries>
+          shadow_tables;
+  
+  // Performance counters; bytes_moved counts bytes read or written by the
+  // current command
+  ProcessStats stats;
+  bool timing;
+  bool huge_pages;
+  uint64_t bytes_moved;
+  
+  // Scratch arena for command data, reused by every command. It grows as
+  // needed up to kScratchLimit bytes; larger ranges are processed in pieces.
+  static const mem::Addr kScratchLimit = 0x10000;
+  
+  // Bytes of virtual memory mapped by one L2 table (see MapRegion)
+  static const mem::Addr kRegionSize = mem::kPageSize * mem::kPageTableEntries;
+  std::vector<uint8_t> scratch;
+  
+  // Pages of the current WriteRange already written by MapRange (mapped to
+  // shared frames), in address order
+  std::vector<mem::Addr> shared_written;
+  
+  // Records merged into the current put or compare (see GatherBatch), after
+  // the first: original line, and offset of its bytes in the merged range
+  struct BatchLine {
+    std::string_view line;
+    mem::Addr offset;
+  };
+  std::vector<BatchLine> batch_lines;
+  std::vector<uint32_t> lookahead_args;  // arguments of a record looked at
+  
+  // Byte values of the current put or compare (including merged records),
+  // packed one per byte by the parser; cmdArgs holds only the address.
+  // Expected values of a compare which don't fit in a byte can never
+  // match, so they are also kept whole in wide_values, with their index.
+  std::vector<uint8_t> cmd_bytes;
+  std::vector<std::pair<mem::Addr, uint32_t>> wide_values;
+  
   
   
   /**
-   * ParseCommand - parse a trace file command.
-   *   Aborts program if invalid trace file.
+   * ExecuteLines - execute commands (Execute without timing)
+   */
+  int ExecuteLines(int num_lines);
+  
+  /**
+   * ParseCommand - parse a trace file command. The line and command are
+   *   returned as views into the mapped trace file.
    * 
    * @param line return the original command line
-   * @param cmd return the command name
-   * @param cmdArgs returns a vector of argument bytes
-   * @return true if command parsed, false if end of file
+   * @param op return the command opcode
+   * @param cmdArgs returns a vector of numeric arguments; the byte values
+   *   of a put or compare are appended to cmd_bytes (and wide_values)
+   *   instead
+   * @param echo false to not echo the line (it is still counted)
+   * @return true if command parsed, false if end of file or invalid binary
+   *   trace (error_message is set)
    */
   bool ParseCommand(
-      std::string &line, std::string &cmd, std::vector<uint32_t> &cmdArgs);
+      std::string_view &line, trace_format::TraceOpcode &op,
+      std::vector<uint32_t> &cmdArgs, bool echo = true);
+  
+  /**
+   * ParseBinaryCommand - decode the next record of a binary trace file.
+   *   Arguments and result are the same as ParseCommand, except that an
+   *   invalid record throws BinaryTraceException.
+   */
+  bool ParseBinaryCommand(
+      std::string_view &line, trace_format::TraceOpcode &op,
+      std::vector<uint32_t> &cmdArgs, bool echo);
+  
+  /**
+   * GatherBatch - merge the records following a put or compare into it
+   *   while they are the same command, continue its range, and can't produce
+   *   output of their own: no page fault, write fault or quota error can
+   *   occur anywhere in the merged range. The command is then one range
+   *   operation; it echoes the merged lines (batch_lines) at the right
+   *   points. The merged range is at most kScratchLimit bytes.
+   * 
+   * @param op kOpPut or kOpCompare
+   * @param cmdArgs arguments of the first record (the bytes of the merged
+   *   records are left appended to cmd_bytes)
+   * @param max_lines most records to merge (the rest of the time slice)
+   */
+  void GatherBatch(trace_format::TraceOpcode op,
+                   std::vector<uint32_t> &cmdArgs, int max_lines);
+  
+  /**
+   * CanBatch - check that a put or compare range of a batch can be done
+   *   without output: every page is present (or in swap), and for a put,
+   *   writable or allocated within the quota. Doesn't use the MMU.
+   * 
+   * @param op kOpPut or kOpCompare
+   * @param addr virtual address of first byte in range
+   * @param count number of bytes in range
+   * @param next_page first page not checked yet for the batch; updated
+   * @param new_pages pages the batch must allocate; updated
+   * @return true if the range can be merged into the batch
+   */
+  bool CanBatch(trace_format::TraceOpcode op, mem::Addr addr, mem::Addr count,
+                uint64_t &next_page, int &new_pages);
+  
+  /**
+   * ReadVarint - read a varint from a binary trace file.
+   *   Throws BinaryTraceException if the file is truncated or the varint is
+   *   malformed.
+   * 
+   * @return decoded value
+   */
+  uint32_t ReadVarint(void);
+  
+  /**
+   * ReadBinaryBytes - read raw bytes from a binary trace file.
+   *   Throws BinaryTraceException if the file is truncated.
+   * 
+   * @param count number of bytes
+   * @return pointer to the bytes in the mapped file
+   */
+  const char *ReadBinaryBytes(size_t count);
+  
+  /**
+   * BinaryTraceException - thrown while decoding a malformed binary record
+   */
+  struct BinaryTraceException {};
+  
+  /**
+   * OutOfFramesException - thrown when a page frame is needed and none can
+   *   be freed; ends the process with a fatal error (see ExecuteLines)
+   */
+  struct OutOfFramesException {};
+  
+  /**
+   * BinaryTraceError - record the error message for a malformed binary
+   *   trace file and throw BinaryTraceException
+   */
+  void BinaryTraceError(void);
+  
+  /**
+   * CmdStatus - result of executing a command
+   */
+  enum CmdStatus {
+    kCmdOk,             // command completed (possibly with a reported error)
+    kCmdQuotaExceeded,  // process terminated for exceeding its quota
+    kCmdFatal           // invalid trace or out of frames (error_message is set)
+  };
+  
+  /**
+   * OutOfFramesError - record the error message for running out of page
+   *   frames
+   * 
+   * @return kCmdFatal
+   */
+  CmdStatus OutOfFramesError(void);
   
   /**
    * Command executors. Arguments are the same for each command.
    *   Form of the function is CmdX, where "X' is the command name, capitalized.
-   * Put, Fill,and Copy all return a bool that indicates if the command completed
-   * successfully. The condition is whether the process exceeded its quota, if so 
-   * it returns false, otherwise true is returned.
+   *   Commands are dispatched through kCmdHandlers, indexed by opcode.
    * @param line original text of command line
-   * @param cmd command, converted to all lower case
    * @param cmdArgs arguments to command
+   * @return status of command
    */
-  void CmdQuota(const std::string &line,
-                const std::string &cmd,
-                const std::vector<uint32_t> &cmdArgs);
-  void CmdCompare(const std::string &line, 
-              const std::string &cmd, 
-              const std::vector<uint32_t> &cmdArgs);
-  bool CmdPut(const std::string &line, 
-              const std::string &cmd, 
-              const std::vector<uint32_t> &cmdArgs);
-  bool CmdFill(const std::string &line, 
-               const std::string &cmd, 
-               const std::vector<uint32_t> &cmdArgs);
-  bool CmdCopy(const std::string &line, 
-               const std::string &cmd, 
-               const std::vector<uint32_t> &cmdArgs);
-  void CmdDump(const std::string &line, 
-               const std::string &cmd, 
-               const std::vector<uint32_t> &cmdArgs);
-  void CmdWritable(const std::string &line, 
-                   const std::string &cmd, 
+  typedef CmdStatus (ProcessTrace::*CmdHandler)(
+          std::string_view line, const std::vector<uint32_t> &cmdArgs);
+  static const CmdHandler kCmdHandlers[trace_format::kOpCount];
+  
+  CmdStatus CmdComment(std::string_view line,
+                       const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdQuota(std::string_view line,
+                     const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdCompare(std::string_view line, 
+                       const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdPut(std::string_view line, 
                    const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdFill(std::string_view line, 
+                    const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdCopy(std::string_view line, 
+                    const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdDump(std::string_view line, 
+                    const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdWritable(std::string_view line, 
+                        const std::vector<uint32_t> &cmdArgs);
+  CmdStatus CmdInvalid(std::string_view line, 
+                       const std::vector<uint32_t> &cmdArgs);
+  
+  /**
+   * EchoLine - write a trace line to output, preceded by the line number
+   *   and process number
+   */
+  void EchoLine(std::string_view line);
+  
+  /**
+   * PrintQuotaExceeded - write the message for termination by exceeding
+   *   the process quota
+   */
+  void PrintQuotaExceeded(void);
   
   /**
    * PrintAndClearException - print a memory exception and clear operation
@@ -201,16 +564,230 @@ private:
    * AllocateAndMapPage - allocate a new user page and add it to the page table
    * 
    * @param vaddr virtual address of page to be mapped
+   * @param clear false if the caller will overwrite the whole page, so it
+   *   need not be cleared to 0
+   * @return physical address of the page frame allocated
+   */
+  mem::Addr AllocateAndMapPage(mem::Addr vaddr, bool clear = true);
+  
+  /**
+   * MapRegion - map every page of the 4 MiB region mapped by one L2 table,
+   *   for a write which covers the whole region: if none of its pages is
+   *   mapped or in swap, the quota allows them all, and the allocator has a
+   *   free block of 1024 adjacent frames, the block is allocated at once
+   *   and the L2 table is written in one pass, entry i mapping frame
+   *   base + i. Quota and fault counts are as for the pages one at a time.
+   *   The frames are not cleared. Only with set_huge_pages, and not with
+   *   page sharing. May leave the MMU in physical mode.
+   * 
+   * @param vaddr virtual address of the region, aligned to its size
+   * @return true if the region was mapped, false if nothing was done
+   */
+  bool MapRegion(mem::Addr vaddr);
+  
+  /**
+   * AllocateFrame - allocate a page frame, evicting a page if there is a
+   *   replacer and no free frame. Throws OutOfFramesException if no frame
+   *   can be had. The MMU must be in physical mode.
+   * 
+   * @param clear false if the caller will overwrite the whole frame
+   * @return physical address of the frame
+   */
+  mem::Addr AllocateFrame(bool clear);
+  
+  /**
+   * ReserveFrame - make sure the allocator has a free frame, as AllocateFrame
+   *   would, for a frame allocated elsewhere (by PageSharing)
    */
-  void AllocateAndMapPage(mem::Addr vaddr);
+  void ReserveFrame(void);
   
   /**
-   * SetWritableStatus - set the writable status of the page
+   * PrepareRange - before a command uses a range of memory, swap in the
+   *   pages of the range which were evicted, and mark the resident pages
+   *   referenced (and dirty, for a write) and pinned until UnpinPages. A read
+   *   range ends at the first page not mapped at all, where the read faults.
+   *   Commands prepare long ranges a piece at a time. No-op without a
+   *   replacer. Restores virtual mode on return.
+   * 
+   * @param addr virtual address of first byte in range
+   * @param count number of bytes in range
+   * @param write true if the range will be written
+   */
+  void PrepareRange(mem::Addr addr, mem::Addr count, bool write);
+  
+  /**
+   * UnpinPages - let the replacer evict the pages pinned so far
+   */
+  void UnpinPages(void) {
+    if (page_replacer != nullptr) {
+      page_replacer->Unpin();
+    }
+  }
+  
+  /**
+   * SwapInPage - bring back a page evicted to swap. Switches to physical
+   *   mode.
+   * 
+   * @param vaddr virtual address of page
+   * @param entry swap entry of the page, which is removed
+   */
+  void SwapInPage(mem::Addr vaddr,
+                  std::unordered_map<mem::Addr, SwapEntry>::iterator entry);
+  
+  /**
+   * GetShadowTable - get the shadow of the L2 table for a virtual address,
+   *   allocating and mapping the L2 table if there is none. The MMU must be
+   *   in physical mode.
+   */
+  ShadowTable &GetShadowTable(mem::Addr vaddr);
+  
+  /**
+   * MapSharedPage - map a page to a shared frame with the given contents
+   *   (see PageSharing). The page must not be present, or be mapped to a
+   *   shared frame (whose reference is then released). The MMU must be in
+   *   physical mode.
+   * 
+   * @param vaddr virtual address of page
+   * @param contents kPageSize bytes of page contents
+   */
+  void MapSharedPage(mem::Addr vaddr, const uint8_t *contents);
+  
+  /**
+   * UnsharePage - before a write to a page mapped to a shared frame which
+   *   the trace has left writable, give the process a private copy of the
+   *   frame (or the frame itself, if no other process shares it).
+   *   Switches to physical mode.
+   * 
+   * @param vaddr virtual address in page
+   * @return true if the page is now private and writable, false if it
+   *   wasn't shared or is read-only (so the write must fault)
+   */
+  bool UnsharePage(mem::Addr vaddr);
+  
+  /**
+   * ChunkSource - supplies the bytes to be written by WriteRange, one piece
+   *   (at most kScratchLimit bytes) at a time.
+   * 
+   * @param offset offset of the piece from the start of the range
+   * @param length number of bytes in the piece
+   * @return pointer to length bytes to write
+   */
+  typedef std::function<const uint8_t*(mem::Addr offset, mem::Addr length)>
+          ChunkSource;
+  
+  /**
+   * MapRange - make sure the pages of a destination range are present before
+   *   writing it, allocating missing pages in address order within the
+   *   process quota. Stops at the first present page which is not writable,
+   *   since the write will fault there. Restores virtual mode on return.
+   *   With page sharing, pages the range covers whole are mapped to shared
+   *   frames holding their new contents instead, and listed in
+   *   shared_written; shared pages covered in part are made private.
+   * 
+   * @param addr virtual address of first byte in range
+   * @param count number of bytes in range
+   * @param source supplies the bytes to be written (for page sharing)
+   * @param mapped_bytes returns number of bytes from addr which can be
+   *   written without allocating a page
+   * @return false if the quota was exceeded at addr + mapped_bytes, else true
+   */
+  bool MapRange(mem::Addr addr, mem::Addr count, const ChunkSource &source,
+                mem::Addr &mapped_bytes);
+  
+  /**
+   * WriteRange - write bytes to memory, allocating destination pages as
+   *   needed. This is the common write path of put, fill and copy: pages are
+   *   mapped first (see MapRange), then the bytes are written once, so no
+   *   page faults occur while writing (with paging, a piece of the range at
+   *   a time). A write permission fault is reported and ends the write.
+   * 
+   * @param addr virtual address of first byte to write
+   * @param count number of bytes to write
+   * @param source supplies the bytes to write
+   * @return kCmdQuotaExceeded if the process quota was exceeded, else kCmdOk
+   */
+  CmdStatus WriteRange(mem::Addr addr, mem::Addr count,
+                       const ChunkSource &source);
+  
+  /**
+   * ReadableBytes - find how much of a range can be read without a page
+   *   fault (counting pages in swap as readable). Doesn't use the MMU.
+   * 
+   * @param addr virtual address of first byte in range
+   * @param count number of bytes in range
+   * @return number of bytes from addr before the first page not present
+   */
+  mem::Addr ReadableBytes(mem::Addr addr, mem::Addr count);
+  
+  /**
+   * ReplayReadFault - report the page fault for reading a byte which is
+   *   known not to be present, exactly as if a bulk read had faulted there.
+   * 
+   * @param vaddr virtual address of byte
+   * @param type description of exception
+   */
+  void ReplayReadFault(mem::Addr vaddr, const std::string &type);
+  
+  /**
+   * ReplayWriteFault - report the write permission fault for writing a byte
+   *   in a page which is known to be read-only. Leaves the MMU in virtual mode.
+   * 
+   * @param vaddr virtual address of byte
+   */
+  void ReplayWriteFault(mem::Addr vaddr);
+  
+  /**
+   * LoadVirtualPmcb, LoadPhysicalPmcb - put the MMU in virtual mode (with
+   *   this process's page table) or physical mode, unless it already is.
+   *   Page table changes and frame allocation are done in physical mode.
+   */
+  void LoadVirtualPmcb(void);
+  void LoadPhysicalPmcb(void);
+  
+  /**
+   * GetScratch - get the process scratch arena, growing it if needed
+   * 
+   * @param bytes number of bytes needed; at most kScratchLimit
+   * @return pointer to the arena
+   */
+  uint8_t *GetScratch(mem::Addr bytes);
+  
+  /**
+   * SetWritableStatus - set the writable status of the page. Switches to
+   *   physical mode if the page table entry changes.
    * 
    * @param vaddr virtual address of page to modify
    * @param writable true to make writable, false to make read-only
    */
   void SetWritableStatus(mem::Addr vaddr, bool writable);
+  
+  /**
+   * LookupPte - get the L2 page table entry for a virtual address from the
+   *   shadow page table, counting the lookup in stats. Doesn't use the MMU.
+   * 
+   * @param vaddr virtual address
+   * @return L2 entry, or 0 (not present) if there is no L2 table for vaddr
+   */
+  mem::PageTableEntry LookupPte(mem::Addr vaddr) {
+    const ShadowTable *table = shadow_tables[vaddr >> (mem::kPageSizeBits
+                                                      + mem::kPageTableSizeBits)].get();
+    ++stats.pte_lookups;
+    if (table == nullptr) {
+      ++stats.pte_lookup_misses;
+      return 0;
+    }
+    return table->entries[(vaddr >> mem::kPageSizeBits) & mem::kPageTableIndexMask];
+  }
+  
+  /**
+   * StorePte - set an L2 page table entry in the table in memory and in its
+   *   shadow. The MMU must be in physical mode.
+   * 
+   * @param table shadow of the L2 table
+   * @param vaddr virtual address mapped by the entry
+   * @param entry new entry
+   */
+  void StorePte(ShadowTable &table, mem::Addr vaddr, mem::PageTableEntry entry);
 };
 
 #endif /* PROCESSTRACE_H */
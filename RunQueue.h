@@ -0,0 +1,98 @@
+/*
+ * RunQueue - intrusive circular run queue of schedulable objects.
+ *
+ * Elements derive from RunQueueNode, which holds the queue links, so
+ * insertion and removal are O(1) and never allocate. The elements are
+ * processes (ProcessTrace, on a worker) and the entries of the round-robin
+ * policy and the policies derived from it (SchedulingPolicy.h). The queue
+ * keeps its elements in insertion order; the element after the last one
+ * (back) is the first one (front), so a scheduler can step through it
+ * round-robin with Next. An element may be in at most one queue at a time.
+ */
+
+/*
+ * File:   RunQueue.h
+ */
+
+#ifndef RUNQUEUE_H
+#define RUNQUEUE_H
+
+#include <cstddef>
+
+/*
+ * RunQueueNode - links of an element in a RunQueue
+ */
+struct RunQueueNode {
+  RunQueueNode *run_next = nullptr;
+  RunQueueNode *run_prev = nullptr;
+};
+
+template <typename T>
+class RunQueue {
+public:
+  RunQueue() : head(nullptr), count(0) {}
+  virtual ~RunQueue() {}
+
+  // Disallow copy/move
+  RunQueue(const RunQueue &other) = delete;
+  RunQueue(RunQueue &&other) = delete;
+  RunQueue &operator=(const RunQueue &other) = delete;
+  RunQueue &operator=(RunQueue &&other) = delete;
+
+  bool empty(void) const { return head == nullptr; }
+  size_t size(void) const { return count; }
+
+  /**
+   * front, back - first and last elements, or nullptr if the queue is empty
+   */
+  T *front(void) const { return static_cast<T*>(head); }
+  T *back(void) const {
+    return head == nullptr ? nullptr : static_cast<T*>(head->run_prev);
+  }
+
+  /**
+   * Next - element after element, wrapping from back to front
+   */
+  static T *Next(T *element) { return static_cast<T*>(element->run_next); }
+
+  /**
+   * PushBack - add an element after the last element
+   */
+  void PushBack(T *element) {
+    RunQueueNode *node = element;
+    if (head == nullptr) {
+      node->run_next = node->run_prev = node;
+      head = node;
+    } else {
+      node->run_next = head;
+      node->run_prev = head->run_prev;
+      head->run_prev->run_next = node;
+      head->run_prev = node;
+    }
+    ++count;
+  }
+
+  /**
+   * Remove - remove an element from the queue
+   */
+  void Remove(T *element) {
+    RunQueueNode *node = element;
+    if (node->run_next == node) {
+      head = nullptr;
+    } else {
+      node->run_prev->run_next = node->run_next;
+      node->run_next->run_prev = node->run_prev;
+      if (head == node) {
+        head = node->run_next;
+      }
+    }
+    node->run_next = node->run_prev = nullptr;
+    --count;
+  }
+
+private:
+  RunQueueNode *head;
+  size_t count;
+};
+
+#endif /* RUNQUEUE_H */
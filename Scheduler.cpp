@@ -10,14 +10,15 @@
  */
 
 #include "Scheduler.h"
+#include "TraceFormat.h"
 
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
-#include <iomanip>
 #include <sstream>
 #include <algorithm>
+#include <iomanip>
 
-using std::cin;
-using std::cout;
 using std::cerr;
 using std::getline;
 using std::istringstream;
@@ -26,46 +27,703 @@ using std::vector;
 using std::ifstream;
 
 Scheduler::Scheduler(vector<std::string> &file_names_, mem::MMU &memory_,
-               PageFrameAllocator &allocator_, int time_slice_)
-: memory(memory_), allocator(allocator_), TIME_SLICE(time_slice_) {
-    NUM_PROCESSES = file_names_.size();
+               PageFrameAllocator &allocator_, OutputSink &output_,
+               int time_slice_, const SchedulerOptions &options_)
+: TIME_SLICE(time_slice_), memory(memory_), allocator(allocator_),
+  pmcb_tracker(memory_), output(output_),
+  MAX_MAPPED_TRACES(options_.max_mapped_traces), mapped_traces(0),
+  ORDERED(options_.ordered), POLICY(options_.policy),
+  TIMING(options_.timing), HUGE_PAGES(options_.huge_pages),
+  SWAP_FILE(options_.swap_file),
+  execute_wall_ns(0), TRACE_EVENTS(options_.trace_events),
+  execute_start_ns(0),
+  policy(SchedulingPolicy::Create(options_.policy, time_slice_)),
+  CHECKPOINT_FILE(options_.checkpoint_file),
+  CHECKPOINT_AT(options_.checkpoint_at),
+  checkpoint_pending(!options_.checkpoint_file.empty()), lines_executed(0),
+  results_taken(0), stopping(false) {
+    NUM_FILES = file_names_.size();
+    process_stats.resize(NUM_FILES);
+    // At least one page frame for each worker (see ParseFiles)
+    THREADS = std::max(1, std::min({options_.threads, NUM_FILES,
+            static_cast<int> (memory.get_frame_count())}));
+    if (options_.dedup) {
+        page_sharing.reset(new PageSharing(memory, allocator));
+    }
+    PageReplacer::PolicyFromName(options_.replacement, REPLACEMENT);
+    if (!SWAP_FILE.empty()) {
+        page_replacer.reset(new PageReplacer(memory, allocator, SWAP_FILE,
+                                             REPLACEMENT));
+    }
+    if (options_.prefetch_depth > 0) {
+        prefetcher.reset(new TracePrefetcher(options_.prefetch_depth,
+                                             options_.prefetch_budget));
+    }
     ParseFiles(file_names_); //initialize processes
+    if (!options_.restore_file.empty()) {
+        RestoreCheckpoint(options_.restore_file);
+    }
+}
+
+namespace {
+/*
+ * SteadyNs - nanoseconds since the epoch of the steady clock
+ */
+uint64_t SteadyNs(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            t.time_since_epoch()).count();
+}
+
+/*
+ * DeleteAll - remove and destroy every process in a run queue
+ */
+void DeleteAll(RunQueue<ProcessTrace> &queue, ObjectPool<ProcessTrace> &pool) {
+    while (!queue.empty()) {
+        ProcessTrace *p = queue.front();
+        queue.Remove(p);
+        pool.Destroy(p);
+    }
+}
 }
 
 Scheduler::~Scheduler() {
+    StopWorkers();
+    for (ProcessTrace* p : processes) {
+        if (p != nullptr) {
+            process_pool.Destroy(p);
+        }
+    }
+    for (std::unique_ptr<Worker> &w : workers) {
+        DeleteAll(w->processes, w->pool);
+    }
 }
 
 void Scheduler::ParseFiles(vector<std::string> &file_names_) {
+    // In parallel mode every worker but the first gets its own memory, and
+    // the page frames of --frames are split between the workers (the first
+    // gets the remainder) so all of them have as much memory as one thread
+    if (THREADS > 1) {
+        mem::Addr frames = memory.get_frame_count();
+        for (int w = 0; w < THREADS; ++w) {
+            mem::Addr share = frames / THREADS + (w == 0 ? frames % THREADS : 0);
+            workers.emplace_back(new Worker);
+            Worker &worker = *workers.back();
+            worker.index = w;
+            if (w == 0) {
+                allocator.LimitFrames(share);
+                worker.memory = &memory;
+                worker.allocator = &allocator;
+                worker.pmcb_tracker = &pmcb_tracker;
+                worker.page_sharing = page_sharing.get();
+                worker.page_replacer = page_replacer.get();
+            } else {
+                worker.own_memory.reset(new mem::MMU(share));
+                worker.own_allocator.reset(
+                        new PageFrameAllocator(*worker.own_memory));
+                worker.own_pmcb_tracker.reset(
+                        new PmcbTracker(*worker.own_memory));
+                worker.memory = worker.own_memory.get();
+                worker.allocator = worker.own_allocator.get();
+                worker.pmcb_tracker = worker.own_pmcb_tracker.get();
+                if (page_sharing) {
+                    worker.own_page_sharing.reset(new PageSharing(
+                            *worker.own_memory, *worker.own_allocator));
+                }
+                worker.page_sharing = worker.own_page_sharing.get();
+                if (page_replacer) {
+                    worker.own_page_replacer.reset(new PageReplacer(
+                            *worker.own_memory, *worker.own_allocator,
+                            SWAP_FILE + "." + std::to_string(w), REPLACEMENT));
+                }
+                worker.page_replacer = worker.own_page_replacer.get();
+            }
+            worker.policy = SchedulingPolicy::Create(POLICY, TIME_SLICE);
+            worker.max_mapped_traces = (MAX_MAPPED_TRACES + THREADS - 1) / THREADS;
+            worker.mapped_traces = 0;
+        }
+    }
+
     int id = 1;
     for(std::string s : file_names_){
-        ProcessTrace* temp = new ProcessTrace(memory, allocator, s, id);
-        processes.push_back(temp);
+        // Check the file now, so a missing file is reported before any
+        // output. It is mapped when its process starts, unless it must be
+        // read before: to count its lines for the policy, or to read it
+        // ahead from the start, even for processes which start later.
+        std::shared_ptr<TraceFile> trace;
+        long line_count = 0;
+        if (prefetcher || policy->NeedsLineCounts()) {
+            trace = TraceFile::Open(s);
+            trace_sizes.push_back(trace->get_size());
+            line_count = CountLines(*trace);
+        } else {
+            trace_sizes.push_back(TraceFile::Check(s));
+        }
+        file_names.push_back(s);
+        policy->Add(id, line_count);
+        TracePrefetcher::Stream *prefetch_stream = nullptr;
+        if (prefetcher) {
+            prefetch_stream = prefetcher->Add(trace);
+        } else {
+            trace.reset();
+        }
+        Task task{trace, prefetch_stream, s, id, line_count};
+        if (THREADS > 1) {
+            Worker &worker = *workers[(id - 1) % THREADS];
+            worker.tasks.push_back(std::move(task));
+            slots.emplace_back(new ProcessSlot);
+            slots.back()->id = id;
+        } else {
+            pending.push_back(std::move(task));
+            processes.push_back(nullptr);
+        }
         ++id;
     }
 }
 
+ProcessTrace *Scheduler::StartProcess(Task &task, mem::MMU &m,
+        PageFrameAllocator &a, PmcbTracker &t, PageSharing *sharing,
+        PageReplacer *replacer, ObjectPool<ProcessTrace> &pool) {
+    std::shared_ptr<TraceFile> trace;
+    trace.swap(task.trace);
+    if (!trace) {
+        trace = TraceFile::Open(task.file_name);
+    }
+    ProcessTrace *proc = pool.Create(m, a, t, trace, task.file_name, task.id);
+    proc->set_timing(TIMING);
+    proc->set_huge_pages(HUGE_PAGES);
+    proc->set_page_sharing(sharing);
+    proc->set_page_replacer(replacer);
+    if (prefetcher) {
+        proc->set_prefetcher(prefetcher.get(), task.prefetch_stream);
+    }
+    return proc;
+}
+
+void Scheduler::TrackTrace(ProcessTrace *proc, bool was_mapped,
+                           bool terminated, size_t &mapped, size_t limit) {
+    if (!was_mapped && proc->has_trace()) {
+        ++mapped;
+    }
+    if (terminated) {
+        mapped -= proc->has_trace();
+    } else if (limit > 0 && mapped > limit && proc->has_trace()) {
+        proc->ReleaseTrace();
+        --mapped;
+    }
+}
+
 void Scheduler::Execute() {
-    int index = 0;
-    int lines;
-    ProcessTrace* current_proc;
-    while(!processes.empty()){
-        current_proc = processes.at(index);
-        lines = current_proc->Execute(TIME_SLICE);
-        if(lines != TIME_SLICE){
-            std::cout << std::dec << (current_proc->getLinesExecuted()) 
-                    << ":" << +current_proc->getID() << ":TERMINATED" << std::endl;
-            processes.erase(processes.begin()+index);
-            --NUM_PROCESSES;
+    auto start = std::chrono::steady_clock::now();
+    execute_start_ns = SteadyNs(start);
+    if (THREADS > 1) {
+        ExecuteParallel();
+    } else {
+        ExecuteSerial();
+    }
+    execute_wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+void Scheduler::ExecuteSerial(void) {
+    QuantumEvent event = QuantumEvent();
+    uint64_t switch_start = LatencyHistogram::Now();
+    for (;;) {
+        // A checkpoint is taken before the policy chooses the next process
+        if (checkpoint_pending && lines_executed >= CHECKPOINT_AT) {
+            WriteCheckpoint();
+        }
+        int id = policy->Next();
+        if (id == 0) {
+            break;
+        }
+        ProcessTrace* current_proc = processes.at(id - 1);
+        bool was_mapped = current_proc != nullptr && current_proc->has_trace();
+        if (current_proc == nullptr) {
+            current_proc = StartProcess(pending[id - 1], memory, allocator,
+                                        pmcb_tracker, page_sharing.get(),
+                                        page_replacer.get(), process_pool);
+            processes[id - 1] = current_proc;
+        }
+        switch_latency.RecordSince(switch_start);
+        SchedulingPolicy::SliceStats stats = RunSlice(
+                current_proc, *policy, TRACE_EVENTS ? &event : nullptr);
+        switch_start = LatencyHistogram::Now();
+        TrackTrace(current_proc, was_mapped, stats.terminated, mapped_traces,
+                   MAX_MAPPED_TRACES);
+        if (TRACE_EVENTS) {
+            quantum_events.push_back(event);
+        }
+        lines_executed += stats.lines;
+        if (checkpoint_pending) {
+            slice_history.push_back(SliceRecord{id, stats});
         }
-        getNextIndex(index);
+        WriteSlice(current_proc->GetOutput(), id,
+                   current_proc->getLinesExecuted(), stats.terminated,
+                   current_proc->GetErrorMessage());
+        if(stats.terminated){
+            processes.at(id - 1) = nullptr;
+            FinishProcess(current_proc, process_pool);
+        }
+        output.FlushIfFull(); //only write output between time slices
+    }
+    output.Flush();
+    if (checkpoint_pending) {
+        cerr << "ERROR: processes ended before line " << CHECKPOINT_AT
+             << ", checkpoint not written: " << CHECKPOINT_FILE << "\n";
+        exit(2);
     }
 }
 
+void Scheduler::ExecuteParallel(void) {
+    for (std::unique_ptr<Worker> &w : workers) {
+        Worker *worker = w.get();
+        worker->thread = std::thread([this, worker] { RunWorker(*worker); });
+    }
 
-void Scheduler::getNextIndex(int& currentIndex) {
-    if (currentIndex + 1 >= NUM_PROCESSES) {
-        currentIndex = 0;
+    OutputBuffer slice_output;
+    SliceResult result;
+    if (ORDERED) {
+        // Replay the serial scheduler's order: run the policy over the
+        // results as they arrive
+        int id;
+        while ((id = policy->Next()) != 0) {
+            TakeResult(*slots[id - 1], slice_output, result);
+            WriteSlice(slice_output, id, result.lines_executed,
+                       result.stats.terminated, result.error);
+            if (TRACE_EVENTS) {
+                quantum_events.push_back(result.event);
+            }
+            policy->Ran(id, result.stats);
+            output.FlushIfFull();
+        }
     } else {
-        ++currentIndex;
+        // Write results as they complete
+        for (int remaining = NUM_FILES; remaining > 0; ) {
+            int id;
+            {
+                std::unique_lock<std::mutex> lock(results_mutex);
+                result_ready.wait(lock, [this] { return !completed.empty(); });
+                id = completed.front();
+                completed.pop_front();
+            }
+            TakeResult(*slots[id - 1], slice_output, result);
+            WriteSlice(slice_output, id, result.lines_executed,
+                       result.stats.terminated, result.error);
+            if (TRACE_EVENTS) {
+                quantum_events.push_back(result.event);
+            }
+            if (result.stats.terminated) {
+                --remaining;
+            }
+            output.FlushIfFull();
+        }
+    }
+
+    StopWorkers();
+    output.Flush();
+}
+
+void Scheduler::RunWorker(Worker &worker) {
+    RunQueue<ProcessTrace> &procs = worker.processes;
+    ProcessTrace *current = nullptr;
+    QuantumEvent event = QuantumEvent();
+    event.thread = worker.index + 1;
+    uint64_t switch_start = LatencyHistogram::Now();
+    for (;;) {
+        // Find the next process which is not too far ahead of the output
+        ProcessTrace *proc = nullptr;
+        uint64_t taken;
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            if (stopping) {
+                return;
+            }
+            taken = results_taken;
+            ProcessTrace *p = current != nullptr ? current : procs.front();
+            for (size_t n = procs.size(); n > 0; --n, p = procs.Next(p)) {
+                if (slots[p->getID() - 1]->results.size() < kMaxSlicesAhead) {
+                    proc = p;
+                    break;
+                }
+            }
+        }
+
+        // If none can run, start another process, or wait for output to be
+        // written
+        bool was_mapped = proc != nullptr && proc->has_trace();
+        if (proc == nullptr) {
+            Task task;
+            if (TakeTask(worker, task)) {
+                proc = StartProcess(task, *worker.memory, *worker.allocator,
+                                    *worker.pmcb_tracker, worker.page_sharing,
+                                    worker.page_replacer, worker.pool);
+                procs.PushBack(proc);
+                worker.policy->Add(task.id, task.line_count);
+            } else if (procs.empty()) {
+                return; //every process has finished
+            } else {
+                std::unique_lock<std::mutex> lock(results_mutex);
+                result_taken.wait(lock, [this, taken] {
+                    return stopping || results_taken != taken;
+                });
+                continue;
+            }
+        }
+
+        // Run its time slice and queue the result
+        int id = proc->getID();
+        worker.switch_latency.RecordSince(switch_start);
+        SchedulingPolicy::SliceStats stats = RunSlice(
+                proc, *worker.policy, TRACE_EVENTS ? &event : nullptr);
+        switch_start = LatencyHistogram::Now();
+        bool terminated = stats.terminated;
+        TrackTrace(proc, was_mapped, terminated, worker.mapped_traces,
+                   worker.max_mapped_traces);
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            ProcessSlot &slot = *slots[id - 1];
+            slot.results.emplace_back();
+            SliceResult &result = slot.results.back();
+            result.output.swap(proc->GetOutput());
+            result.lines_executed = proc->getLinesExecuted();
+            result.stats = stats;
+            result.error = proc->GetErrorMessage();
+            result.event = event;
+            completed.push_back(id);
+        }
+        result_ready.notify_one();
+
+        if (terminated) {
+            current = procs.size() > 1 ? procs.Next(proc) : nullptr;
+            procs.Remove(proc);
+            FinishProcess(proc, worker.pool);
+        } else {
+            current = procs.Next(proc);
+        }
+    }
+}
+
+bool Scheduler::TakeTask(Worker &worker, Task &task) {
+    // Oldest of the worker's own tasks
+    {
+        std::lock_guard<std::mutex> lock(worker.tasks_mutex);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Otherwise steal the newest task of the next worker which has one
+    for (int i = 1; i < THREADS; ++i) {
+        Worker &victim = *workers[(worker.index + i) % THREADS];
+        std::lock_guard<std::mutex> lock(victim.tasks_mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::TakeResult(ProcessSlot &slot, OutputBuffer &slice_output,
+                           SliceResult &result) {
+    {
+        std::unique_lock<std::mutex> lock(results_mutex);
+        std::deque<SliceResult> &queue = slot.results;
+        result_ready.wait(lock, [&queue] { return !queue.empty(); });
+        SliceResult &front = queue.front();
+        slice_output.swap(front.output);
+        result.lines_executed = front.lines_executed;
+        result.stats = front.stats;
+        result.error.swap(front.error);
+        result.event = front.event;
+        queue.pop_front();
+        ++results_taken;
+    }
+    result_taken.notify_all();
+}
+
+uint64_t Scheduler::get_pmcb_switches(void) const {
+    uint64_t switches = pmcb_tracker.get_switches();
+    for (const std::unique_ptr<Worker> &w : workers) {
+        if (w->own_pmcb_tracker) {
+            switches += w->own_pmcb_tracker->get_switches();
+        }
+    }
+    return switches;
+}
+
+uint64_t Scheduler::get_pmcb_switches_skipped(void) const {
+    uint64_t skipped = pmcb_tracker.get_skipped();
+    for (const std::unique_ptr<Worker> &w : workers) {
+        if (w->own_pmcb_tracker) {
+            skipped += w->own_pmcb_tracker->get_skipped();
+        }
+    }
+    return skipped;
+}
+
+void Scheduler::WriteStats(std::ostream &out, bool json) const {
+    SchedulerStats scheduler;
+    AllocatorStats allocators;
+    GetStats(scheduler, allocators);
+    if (json) {
+        WriteStatsJson(out, scheduler, allocators, process_stats);
+    } else {
+        WriteStatsTable(out, scheduler, allocators, process_stats);
+    }
+}
+
+const std::vector<ProcessStats> &Scheduler::GetStats(
+        SchedulerStats &scheduler, AllocatorStats &allocators) const {
+    scheduler = SchedulerStats();
+    scheduler.threads = THREADS;
+    scheduler.processes = NUM_FILES;
+    for (const ProcessStats &p : process_stats) {
+        scheduler.quanta += p.quanta;
+    }
+    scheduler.pmcb_switches = get_pmcb_switches();
+    scheduler.pmcb_switches_skipped = get_pmcb_switches_skipped();
+    if (prefetcher) {
+        scheduler.bytes_prefetched = prefetcher->get_bytes_prefetched();
+    }
+    scheduler.wall_ns = execute_wall_ns;
+    scheduler.switch_latency = switch_latency;
+    for (const std::unique_ptr<Worker> &w : workers) {
+        scheduler.switch_latency.Add(w->switch_latency);
+    }
+
+    allocators = allocator.get_stats();
+    for (const std::unique_ptr<Worker> &w : workers) {
+        if (w->own_allocator) {
+            allocators.Add(w->own_allocator->get_stats());
+        }
+    }
+    return process_stats;
+}
+
+void Scheduler::FinishProcess(ProcessTrace *proc,
+                              ObjectPool<ProcessTrace> &pool) {
+    // Each process has its own entry, so workers need no lock
+    process_stats.at(proc->getID() - 1) = proc->GetStats();
+    pool.Destroy(proc); //frees the process's page frames
+}
+
+SchedulingPolicy::SliceStats Scheduler::RunSlice(
+        ProcessTrace *proc, SchedulingPolicy &slice_policy,
+        QuantumEvent *event) {
+    int id = proc->getID();
+    int slice = slice_policy.TimeSlice(id);
+    long pages = proc->get_allocated_pages();
+    uint64_t faults = proc->GetStats().page_faults;
+    uint64_t start = event ? SteadyNs(std::chrono::steady_clock::now()) : 0;
+    SchedulingPolicy::SliceStats stats;
+    stats.lines = proc->Execute(slice);
+    stats.pages_allocated = proc->get_allocated_pages() - pages;
+    stats.terminated = stats.lines != slice;
+    if (event != nullptr) {
+        event->id = id;
+        event->start_ns = start;
+        event->duration_ns = SteadyNs(std::chrono::steady_clock::now()) - start;
+        event->stats = stats;
+        event->page_faults = proc->GetStats().page_faults - faults;
+    }
+    slice_policy.Ran(id, stats);
+    return stats;
+}
+
+long Scheduler::CountLines(const TraceFile &trace) {
+    if (!policy->NeedsLineCounts()) {
+        return 0;
+    }
+    return trace_format::CountTraceLines(trace.begin(), trace.end());
+}
+
+void Scheduler::WriteSlice(OutputBuffer &slice_output, int id,
+                           long lines_executed, bool terminated,
+                           const string &error) {
+    if (!error.empty()) {
+        // Invalid trace: write what the process produced and exit
+        StopWorkers();
+        cerr << error;
+        output.Write(slice_output);
+        output.Flush();
+        exit(2);
+    }
+    output.Write(slice_output);
+    if (terminated) {
+        status.AppendDec(lines_executed);
+        status.Append(':');
+        status.AppendDec(id);
+        status.Append(":TERMINATED\n");
+        output.Write(status);
+    }
+}
+
+void Scheduler::StopWorkers(void) {
+    {
+        std::lock_guard<std::mutex> lock(results_mutex);
+        stopping = true;
+    }
+    result_taken.notify_all();
+    for (std::unique_ptr<Worker> &w : workers) {
+        if (w->thread.joinable()) {
+            w->thread.join();
+        }
+    }
+}
+
+namespace {
+// Start of every checkpoint file, and version of its layout
+const char kCheckpointMagic[8] = {'M', 'M', 'U', 'C', 'K', 'P', 'T', 0};
+const uint32_t kCheckpointVersion = 1;
+}
+
+void Scheduler::WriteCheckpoint(void) {
+    CheckpointWriter out(CHECKPOINT_FILE);
+    out.PutBytes(kCheckpointMagic, sizeof kCheckpointMagic);
+    out.Put(kCheckpointVersion);
+    out.Put<uint32_t>(sizeof (ProcessStats));
+    out.Put<uint32_t>(sizeof (AllocatorStats));
+    out.Put<int32_t>(TIME_SLICE);
+    out.PutString(POLICY);
+    out.Put<uint32_t>(NUM_FILES);
+    for (int i = 0; i < NUM_FILES; ++i) {
+        out.PutString(file_names[i]);
+        out.Put(trace_sizes[i]);
+    }
+
+    out.Put(lines_executed);
+    out.Put<uint64_t>(slice_history.size());
+    for (const SliceRecord &slice : slice_history) {
+        out.Put<int32_t>(slice.id);
+        out.Put<int64_t>(slice.stats.lines);
+        out.Put<int64_t>(slice.stats.pages_allocated);
+        out.Put<uint8_t>(slice.stats.terminated);
+    }
+
+    allocator.SaveState(out);
+    for (int i = 0; i < NUM_FILES; ++i) {
+        out.Put(process_stats[i]);
+        out.Put<uint8_t>(processes[i] != nullptr);
+        if (processes[i] != nullptr) {
+            processes[i]->SaveState(out);
+        }
+    }
+    out.Finish();
+    checkpoint_pending = false;
+    slice_history.clear();
+}
+
+void Scheduler::RestoreCheckpoint(const string &file_name) {
+    CheckpointReader in(file_name);
+    const uint8_t *magic = in.GetBytes(sizeof kCheckpointMagic);
+    if (!std::equal(magic, magic + sizeof kCheckpointMagic,
+                    reinterpret_cast<const uint8_t*> (kCheckpointMagic))
+            || in.Get<uint32_t>() != kCheckpointVersion
+            || in.Get<uint32_t>() != sizeof (ProcessStats)
+            || in.Get<uint32_t>() != sizeof (AllocatorStats)) {
+        in.Mismatch("not a checkpoint of this simulator");
+    }
+    if (in.Get<int32_t>() != TIME_SLICE) {
+        in.Mismatch("time slice");
+    }
+    if (in.GetString() != POLICY) {
+        in.Mismatch("scheduling policy");
+    }
+    if (in.Get<uint32_t>() != static_cast<uint32_t>(NUM_FILES)) {
+        in.Mismatch("number of trace files");
+    }
+    for (int i = 0; i < NUM_FILES; ++i) {
+        if (in.GetString() != file_names[i]
+                || in.Get<uint64_t>() != trace_sizes[i]) {
+            in.Mismatch("trace file " + file_names[i]);
+        }
+    }
+
+    // Bring the policy to where it was by replaying the slices it was told
+    // about, exactly as ExecuteSerial ran them
+    lines_executed = in.Get<uint64_t>();
+    uint64_t slices = in.Get<uint64_t>();
+    for (uint64_t n = 0; n < slices; ++n) {
+        SliceRecord slice;
+        slice.id = in.Get<int32_t>();
+        slice.stats.lines = in.Get<int64_t>();
+        slice.stats.pages_allocated = in.Get<int64_t>();
+        slice.stats.terminated = in.Get<uint8_t>() != 0;
+        if (policy->Next() != slice.id) {
+            in.Mismatch("order of time slices");
+        }
+        policy->TimeSlice(slice.id);
+        policy->Ran(slice.id, slice.stats);
+        if (checkpoint_pending) {
+            slice_history.push_back(slice);
+        }
+    }
+
+    allocator.RestoreState(in);
+    for (int i = 0; i < NUM_FILES; ++i) {
+        process_stats[i] = in.Get<ProcessStats>();
+        if (in.Get<uint8_t>() != 0) {
+            processes[i] = StartProcess(pending[i], memory, allocator,
+                                        pmcb_tracker, page_sharing.get(),
+                                        page_replacer.get(), process_pool);
+            ++mapped_traces;
+            processes[i]->RestoreState(in);
+        }
+    }
+    if (!in.at_end()) {
+        in.Mismatch("unexpected data at end");
+    }
+}
+
+namespace {
+/*
+ * WriteJsonString - write a string as a quoted JSON string
+ */
+void WriteJsonString(std::ostream &out, const string &s) {
+    out << '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            static const char kHex[] = "0123456789abcdef";
+            out << "\\u00" << kHex[c >> 4] << kHex[c & 0xf];
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+}
+
+void Scheduler::WriteTraceEvents(std::ostream &out) const {
+    // Times are in microseconds from the start of Execute
+    std::ios_base::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+        << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+        << "\"args\": {\"name\": \"scheduler\"}}";
+    for (int w = 0; w < static_cast<int>(workers.size()); ++w) {
+        out << ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+            << "\"tid\": " << w + 1 << ", \"args\": {\"name\": \"worker " << w
+            << "\"}}";
+    }
+    for (const QuantumEvent &e : quantum_events) {
+        out << ",\n  {\"name\": \"process " << e.id
+            << "\", \"cat\": \"quantum\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+            << e.thread << ", \"ts\": "
+            << (e.start_ns - execute_start_ns) / 1e3
+            << ", \"dur\": " << e.duration_ns / 1e3 << ", \"args\": {\"file\": ";
+        WriteJsonString(out, file_names[e.id - 1]);
+        out << ", \"lines\": " << e.stats.lines
+            << ", \"pages_allocated\": " << e.stats.pages_allocated
+            << ", \"page_faults\": " << e.page_faults
+            << ", \"terminated\": " << (e.stats.terminated ? "true" : "false")
+            << "}}";
     }
+    out << "\n]}\n";
+    out.flags(flags);
 }
@@ -1,17 +1,48 @@
 /*
  * Scheduler class to implement Round-Robin
- * scheduling algorithm
+ * scheduling algorithm (and the other policies of SchedulingPolicy)
  */
 
 /*
  * Takes in references to the MMU and PageFrameAllocator as well as the time_slice (number
  * of lines each process executes while being run) and a vector of file_names. 
- * The constructor passes the file_names to ParseFiles method which creates instances of 
- * ProcessTraces for each file name. These are stored in a global vector.
- * When Execute is called, the processes are executed in a Round-Robin fashion with each
- * process executing TIME_SLICE number of lines. When a process terminates (either from exceeding
- * its page frame quota or reaching the end of the file) a termination line is printed
- * and the process is removed from the process queue (the global vector of processes)
+ * The constructor passes the file_names to ParseFiles method which checks each file and
+ * makes it a Task. A process is started (its ProcessTrace created, in a pool, and its
+ * trace mapped) only when the policy first chooses it, so processes waiting to start cost
+ * no mapping, page frames or ProcessTrace. Running processes are stored in a vector
+ * indexed by process number.
+ * When Execute is called, the processes are executed in the order chosen by the scheduling
+ * policy (by default Round-Robin, with each process executing TIME_SLICE number of lines).
+ * When a process terminates (either from exceeding
+ * its page frame quota or reaching the end of the file) a termination line is printed,
+ * the process is removed from the policy and deleted, returning its page frames
+ * to the allocator.
+ * Output of each process is collected during its time slice and passed to the
+ * OutputSink after the slice, so it is only written between time slices.
+ *
+ * Parallel mode: with more than one thread, processes run on worker threads.
+ * Processes share nothing but physical memory, so each worker has its own MMU
+ * and PageFrameAllocator over an equal share of the page frames (the first
+ * worker uses the ones passed in, limited to its share), and its own swap file (the name given, followed by "." and the worker number for
+ * all but the first). Trace files are checked up front, and each becomes a
+ * Task on a worker's deque (process i on worker (i - 1) % threads). A worker starts a task (creating
+ * its ProcessTrace in the worker's memory and pool) when none of its running
+ * processes can run, taking the oldest of its own tasks, or stealing the
+ * newest task of another worker when its own deque is empty. Once started, a
+ * process only runs on that worker, which does round-robin over its
+ * processes (RunQueue), with slice lengths from its own policy object. Each
+ * time slice produces a SliceResult, queued for the main
+ * thread, which writes all output. In ordered mode the main thread runs the policy over the
+ * results, taking them in exactly the order the serial scheduler would have run the slices,
+ * so the output is identical unless a worker runs out of page frames which
+ * the serial scheduler would have had; otherwise results are written as they
+ * complete. A
+ * worker runs at most kMaxSlicesAhead slices of a process ahead of the output.
+ *
+ * Checkpoints: in serial mode the scheduler can write the whole state of the
+ * simulation to a file between time slices (WriteCheckpoint), and a later run
+ * with the same settings can resume from it (RestoreCheckpoint), producing
+ * the output the first run produced after the checkpoint.
  * 
  */
 
@@ -26,22 +57,93 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include "Checkpoint.h"
+#include "OutputBuffer.h"
+#include "OutputSink.h"
+#include "LatencyProfile.h"
+#include "ObjectPool.h"
 #include "PageFrameAllocator.h"
+#include "PageReplacer.h"
+#include "PageSharing.h"
+#include "PmcbTracker.h"
 #include "ProcessTrace.h"
+#include "RunQueue.h"
+#include "SchedulingPolicy.h"
+#include "SimulatorStats.h"
+#include "TraceFile.h"
+#include "TracePrefetcher.h"
 #include <MMU.h>
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <queue>
+#include <thread>
 #include <vector>
 #include <string>
 #include <fstream>
 
+/**
+ * SchedulerOptions - optional settings of the Scheduler
+ */
+struct SchedulerOptions {
+    // number of worker threads; 1 runs every process on the calling thread
+    int threads = 1;
+    // in parallel mode, write output in the same order as the serial
+    // scheduler (otherwise in order of completion)
+    bool ordered = true;
+    // scheduling policy name (see SchedulingPolicy::Create)
+    std::string policy = "rr";
+    // measure wall and CPU time of every time slice for WriteStats
+    bool timing = false;
+    // share frames of identical pages (see PageSharing.h)
+    bool dedup = false;
+    // map whole 4 MiB regions written at once (see ProcessTrace::MapRegion)
+    bool huge_pages = false;
+    // swap file for pages evicted when page frames run out (see
+    // PageReplacer.h); empty for no paging
+    std::string swap_file;
+    // page replacement policy name (see PageReplacer::PolicyFromName)
+    std::string replacement = "clock";
+    // bytes of each trace to read ahead of its process (see
+    // TracePrefetcher.h); 0 for no prefetching
+    size_t prefetch_depth = 0;
+    // most bytes read ahead over all traces
+    size_t prefetch_budget = 64 << 20;
+    // file to write a checkpoint of the simulation to (see
+    // Scheduler::WriteCheckpoint), once checkpoint_at lines have been
+    // executed over all processes; empty for none. Serial mode only,
+    // without dedup or swap.
+    std::string checkpoint_file;
+    uint64_t checkpoint_at = 0;
+    // checkpoint to resume from, written by a run with the same trace
+    // files, time slice, policy and memory size; empty to start afresh
+    std::string restore_file;
+    // record the start, length and work of every time slice for
+    // WriteTraceEvents
+    bool trace_events = false;
+    // most traces kept mapped by processes between their time slices (in
+    // parallel mode, divided between the workers); the trace of a process
+    // which has just run is released when there are more (see
+    // ProcessTrace::ReleaseTrace), and mapped again when it next runs.
+    // 0 for no limit. Not used with prefetching.
+    size_t max_mapped_traces = 0;
+};
+
 class Scheduler {
 public:
     /**
      * Constructor - initialize processing
+     *
+     * @param options_ threads, ordering, policies and paging; the policy
+     *   names must be valid
      */
     Scheduler(std::vector<std::string> &file_names_, mem::MMU &memory_,
-               PageFrameAllocator &allocator_, int time_slice_);
+               PageFrameAllocator &allocator_, OutputSink &output_,
+               int time_slice_,
+               const SchedulerOptions &options_ = SchedulerOptions());
 
     /**
      * Destructor - clean up processing
@@ -62,16 +164,191 @@ public:
      */
     void Execute();
 
+    /**
+     * get_pmcb_switches, get_pmcb_switches_skipped - number of PMCB loads
+     *   done and avoided (because the PMCB was already loaded), over all
+     *   MMUs
+     */
+    uint64_t get_pmcb_switches(void) const;
+    uint64_t get_pmcb_switches_skipped(void) const;
+
+    /**
+     * WriteStats - write the performance counters of the run (see
+     *   SimulatorStats.h). Call after Execute.
+     *
+     * @param out destination of report
+     * @param json true for JSON, false for a table
+     */
+    void WriteStats(std::ostream &out, bool json) const;
+
+    /**
+     * GetStats - performance counters of the run, as written by WriteStats.
+     *   Call after Execute.
+     *
+     * @param scheduler set to scheduler counters
+     * @param allocators set to the counters of all allocators added
+     * @return counters of each process, by process number
+     */
+    const std::vector<ProcessStats> &GetStats(SchedulerStats &scheduler,
+                                              AllocatorStats &allocators) const;
+
+    /**
+     * WriteTraceEvents - write the time slices run as Chrome trace event
+     *   JSON (for chrome://tracing or Perfetto): one complete event per
+     *   slice, on a track for the thread which ran it, with the lines,
+     *   pages allocated and page faults of the slice. Call after Execute,
+     *   with SchedulerOptions::trace_events set.
+     *
+     * @param out destination of JSON
+     */
+    void WriteTraceEvents(std::ostream &out) const;
 
 private:
     int TIME_SLICE; //number of lines to process 
-    int NUM_PROCESSES; //number of processes currently running
     // Memory contents
     mem::MMU &memory;
     // Memory allocator
     PageFrameAllocator &allocator;
-    //vector of all processes
+    // Tracker of the PMCB loaded in memory
+    PmcbTracker pmcb_tracker;
+    // Registry of shared frames in memory, or null without --dedup
+    std::unique_ptr<PageSharing> page_sharing;
+    // Page replacement in memory, or null without a swap file
+    std::unique_ptr<PageReplacer> page_replacer;
+    // Reader of traces ahead of execution, or null without prefetching
+    std::unique_ptr<TracePrefetcher> prefetcher;
+    // Destination of all output, written at time slice boundaries
+    OutputSink &output;
+    // Scheduler messages (TERMINATED lines)
+    OutputBuffer status;
+    //all processes by id - 1, null until started and once terminated
+    //(serial mode)
     std::vector<ProcessTrace*> processes;
+    //storage of the processes (serial mode)
+    ObjectPool<ProcessTrace> process_pool;
+    //limit and count of traces mapped by processes (serial mode)
+    size_t MAX_MAPPED_TRACES;
+    size_t mapped_traces;
+    int THREADS; //number of worker threads
+    bool ORDERED; //parallel output in serial order
+    int NUM_FILES; //number of processes started
+    std::string POLICY; //scheduling policy name
+    bool TIMING; //time every slice of every process
+    bool HUGE_PAGES; //map whole regions at once
+    std::string SWAP_FILE; //swap file name, empty for no paging
+    PageReplacer::Policy REPLACEMENT; //page replacement policy
+    //counters of each terminated process (by id - 1), and time of Execute
+    std::vector<ProcessStats> process_stats;
+    uint64_t execute_wall_ns;
+    //time between time slices of the calling thread (serial mode)
+    LatencyHistogram switch_latency;
+
+    /**
+     * QuantumEvent - when a time slice ran, and what it did
+     */
+    struct QuantumEvent {
+        int id;
+        int thread;  // 0 for the calling thread, else worker index + 1
+        uint64_t start_ns;  // steady clock
+        uint64_t duration_ns;
+        SchedulingPolicy::SliceStats stats;
+        uint64_t page_faults;
+    };
+    bool TRACE_EVENTS; //record quantum_events
+    uint64_t execute_start_ns; //steady clock time Execute started
+    //every time slice, in the order the output was written
+    std::vector<QuantumEvent> quantum_events;
+    //policy choosing the order processes run (and their output is written)
+    std::unique_ptr<SchedulingPolicy> policy;
+    //trace file names and sizes, by id - 1 (checked on restore)
+    std::vector<std::string> file_names;
+    std::vector<uint64_t> trace_sizes;
+    std::string CHECKPOINT_FILE; //checkpoint to write, empty for none
+    uint64_t CHECKPOINT_AT; //lines executed before the checkpoint
+    bool checkpoint_pending; //checkpoint not written yet
+    uint64_t lines_executed; //over all processes (serial mode)
+
+    /**
+     * SliceRecord - a time slice run, as reported to the policy
+     */
+    struct SliceRecord {
+        int id;
+        SchedulingPolicy::SliceStats stats;
+    };
+    //every time slice run, in order, while a checkpoint is pending
+    std::vector<SliceRecord> slice_history;
+
+    /**
+     * Task - a process which has not started running
+     */
+    struct Task {
+        // mapped trace, or null to map it when the process starts (it is
+        // mapped early only for prefetching)
+        std::shared_ptr<TraceFile> trace;
+        TracePrefetcher::Stream *prefetch_stream;  // null without prefetching
+        std::string file_name;
+        int id;
+        long line_count;  // if the policy needs line counts, else 0
+    };
+    //tasks of all processes by id - 1, used when each starts (serial mode)
+    std::vector<Task> pending;
+
+    /**
+     * Worker - a worker thread and the memory its processes run in
+     */
+    struct Worker {
+        int index;
+        mem::MMU *memory;
+        PageFrameAllocator *allocator;
+        PmcbTracker *pmcb_tracker;
+        PageSharing *page_sharing;  // null without --dedup
+        PageReplacer *page_replacer;  // null without --swap
+        std::unique_ptr<mem::MMU> own_memory;  // null for the first worker
+        std::unique_ptr<PageFrameAllocator> own_allocator;
+        std::unique_ptr<PmcbTracker> own_pmcb_tracker;
+        std::unique_ptr<PageSharing> own_page_sharing;
+        std::unique_ptr<PageReplacer> own_page_replacer;
+        RunQueue<ProcessTrace> processes;  // running processes of the worker
+        std::unique_ptr<SchedulingPolicy> policy;  // slice lengths
+        LatencyHistogram switch_latency;  // time between slices
+        ObjectPool<ProcessTrace> pool;  // storage of the worker's processes
+        size_t max_mapped_traces;  // limit and count of traces mapped
+        size_t mapped_traces;
+        std::deque<Task> tasks;  // processes not started, guarded by tasks_mutex
+        std::mutex tasks_mutex;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /**
+     * SliceResult - what one time slice of a process produced
+     */
+    struct SliceResult {
+        OutputBuffer output;  // output of the slice
+        long lines_executed;  // total lines executed by the process
+        SchedulingPolicy::SliceStats stats;  // what the slice did
+        std::string error;    // fatal trace error, if any
+        QuantumEvent event;   // if TRACE_EVENTS
+    };
+
+    /**
+     * ProcessSlot - results of a process not yet written
+     */
+    struct ProcessSlot {
+        int id;
+        std::deque<SliceResult> results;
+    };
+
+    // Slot of each process (by id - 1), ids of the results in order of
+    // completion, and count of results taken; guarded by results_mutex
+    static const size_t kMaxSlicesAhead = 64;
+    std::vector<std::unique_ptr<ProcessSlot>> slots;
+    std::deque<int> completed;
+    uint64_t results_taken;
+    bool stopping; //workers must exit
+    std::mutex results_mutex;
+    std::condition_variable result_ready; //signalled when a result is queued
+    std::condition_variable result_taken; //signalled when a result is written
 
     /**
      * Extracts information from input file 
@@ -85,11 +362,148 @@ private:
     void ParseFiles(std::vector<std::string> &file_names_);
 
     /**
-     * Sets the currentIndex to the next valid index of the process list
-     * (wraps the list)
-     * @param currentIndex
+     * ExecuteSerial - run all processes on the calling thread
+     */
+    void ExecuteSerial(void);
+
+    /**
+     * ExecuteParallel - run the processes on the worker threads, writing
+     *   their output from the calling thread
+     */
+    void ExecuteParallel(void);
+
+    /**
+     * RunWorker - body of a worker thread: round-robin over the worker's
+     *   processes, queueing the result of each time slice
+     *
+     * @param worker the worker
+     */
+    void RunWorker(Worker &worker);
+
+    /**
+     * TakeTask - get a task for a worker to start: the oldest of its own
+     *   tasks, otherwise the newest task of another worker
+     *
+     * @param worker the worker
+     * @param task returns the task
+     * @return false if there are no tasks left
+     */
+    bool TakeTask(Worker &worker, Task &task);
+
+    /**
+     * TakeResult - wait for the next result of a process and remove it from
+     *   its slot
+     *
+     * @param slot slot of the process
+     * @param slice_output returns output of the slice
+     * @param result returns the rest of the result (its output is left empty)
+     */
+    void TakeResult(ProcessSlot &slot, OutputBuffer &slice_output,
+                    SliceResult &result);
+
+    /**
+     * RunSlice - run a time slice of a process
+     *
+     * @param proc the process
+     * @param slice_policy policy giving the length of the slice, told what
+     *   the slice did
+     * @param event if not null, set to when the slice ran and what it did
+     *   (but not which thread ran it)
+     * @return what the slice did
+     */
+    static SchedulingPolicy::SliceStats RunSlice(
+            ProcessTrace *proc, SchedulingPolicy &slice_policy,
+            QuantumEvent *event = nullptr);
+
+    /**
+     * StartProcess - create the process of a task, mapping its trace
+     *
+     * @param task task of the process; its trace is released
+     * @param m, a, t, sharing, replacer memory the process runs in, and its
+     *   allocator, PMCB tracker, registry of shared frames and replacer
+     * @param pool pool to create the process in
+     * @return the process
+     */
+    ProcessTrace *StartProcess(Task &task, mem::MMU &m, PageFrameAllocator &a,
+                               PmcbTracker &t, PageSharing *sharing,
+                               PageReplacer *replacer,
+                               ObjectPool<ProcessTrace> &pool);
+
+    /**
+     * TrackTrace - after a time slice, count the trace of the process if it
+     *   was mapped during the slice, and release it if more traces than
+     *   the limit are mapped. The process just run is the one round-robin
+     *   will come back to last.
+     *
+     * @param proc process which ran
+     * @param was_mapped true if the process held its trace before the slice
+     * @param terminated true if the process terminated (its trace is no
+     *   longer counted)
+     * @param mapped count of traces mapped
+     * @param limit most traces mapped, 0 for no limit
+     */
+    static void TrackTrace(ProcessTrace *proc, bool was_mapped,
+                           bool terminated, size_t &mapped, size_t limit);
+
+    /**
+     * FinishProcess - save the counters of a terminated process and destroy
+     *   it, returning its page frames
+     *
+     * @param proc the process
+     * @param pool pool the process was created in
+     */
+    void FinishProcess(ProcessTrace *proc, ObjectPool<ProcessTrace> &pool);
+
+    /**
+     * CountLines - line count of a trace to give the policy
+     *
+     * @param trace mapped trace file
+     * @return number of lines, or 0 if the policy doesn't need line counts
+     */
+    long CountLines(const TraceFile &trace);
+
+    /**
+     * WriteSlice - write the output of a time slice and, if the process
+     *   terminated, the termination line. Exits the program after writing
+     *   pending output if the process had a fatal error.
+     *
+     * @param slice_output output of the slice
+     * @param id process number
+     * @param lines_executed total lines executed by the process
+     * @param terminated true if the process terminated during the slice
+     * @param error fatal error message, empty if none
+     */
+    void WriteSlice(OutputBuffer &slice_output, int id, long lines_executed,
+                    bool terminated, const std::string &error);
+
+    /**
+     * StopWorkers - make all worker threads exit and wait for them
+     */
+    void StopWorkers(void);
+
+    /**
+     * WriteCheckpoint - write the state of the simulation between time
+     *   slices to CHECKPOINT_FILE (see Checkpoint.h): the run's settings and
+     *   trace files, the time slices run so far, the allocator's free
+     *   blocks, and each process's counters and, if it is still running,
+     *   its state (see ProcessTrace::SaveState). Policies keep their state
+     *   in different forms, so it is saved as the slices they were told
+     *   about, which are replayed on restore. Only frames in use are
+     *   written, so the file size depends on the pages in use, not the size
+     *   of memory.
+     */
+    void WriteCheckpoint(void);
+
+    /**
+     * RestoreCheckpoint - resume from a checkpoint written by
+     *   WriteCheckpoint, before Execute: replay its time slices into the
+     *   policy, and restore the allocator and processes. Reports an error to
+     *   cerr and exits if the checkpoint is not of this run's settings and
+     *   trace files.
+     *
+     * @param file_name checkpoint file
      */
-    void getNextIndex(int& currentIndex);
+    void RestoreCheckpoint(const std::string &file_name);
 };
 
 #endif /* SCHEDULER_H */
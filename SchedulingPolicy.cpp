@@ -0,0 +1,140 @@
+/*
+ * SchedulingPolicy implementations
+ */
+
+/*
+ * File:   SchedulingPolicy.cpp
+ */
+
+#include "SchedulingPolicy.h"
+
+#include <algorithm>
+#include <climits>
+
+std::unique_ptr<SchedulingPolicy> SchedulingPolicy::Create(
+        const std::string &name, int time_slice) {
+  std::unique_ptr<SchedulingPolicy> policy;
+  if (name == "rr") {
+    policy.reset(new RoundRobinPolicy(time_slice));
+  } else if (name == "srl") {
+    policy.reset(new ShortestRemainingPolicy(time_slice));
+  } else if (name == "fault") {
+    policy.reset(new FaultAwarePolicy(time_slice));
+  } else if (name == "adaptive") {
+    policy.reset(new AdaptiveSlicePolicy(time_slice));
+  }
+  return policy;
+}
+
+void RoundRobinPolicy::Add(int id, long) {
+  Entry *entry = new Entry;
+  entry->id = id;
+  entry->skip = 0;
+  entry->slice = time_slice;
+  entries[id].reset(entry);
+  queue.PushBack(entry);
+}
+
+int RoundRobinPolicy::Next(void) {
+  if (current == nullptr) {
+    current = queue.front();
+  }
+  return current != nullptr ? current->id : 0;
+}
+
+void RoundRobinPolicy::Ran(int id, const SliceStats &stats) {
+  Entry *entry = Find(id);
+  if (entry == nullptr) {
+    return;
+  }
+  if (!stats.terminated) {
+    if (entry == current) {
+      current = RunQueue<Entry>::Next(entry);
+    }
+    return;
+  }
+
+  // A terminated process is removed in the order of the original vector
+  // scheduler: its successor moved into its index and was skipped for the
+  // round, unless it was one of the last two, when the round restarted at
+  // the front
+  if (entry == current) {
+    Entry *next = nullptr;
+    if (entry != queue.back() && RunQueue<Entry>::Next(entry) != queue.back()) {
+      next = RunQueue<Entry>::Next(RunQueue<Entry>::Next(entry));
+    }
+    queue.Remove(entry);
+    current = next != nullptr ? next : queue.front();
+  } else {
+    queue.Remove(entry);
+  }
+  entries.erase(id);
+}
+
+RoundRobinPolicy::Entry *RoundRobinPolicy::Find(int id) {
+  auto found = entries.find(id);
+  return found != entries.end() ? found->second.get() : nullptr;
+}
+
+void ShortestRemainingPolicy::Add(int id, long line_count) {
+  remaining[id] = line_count;
+  ready.insert(std::make_pair(line_count, id));
+}
+
+int ShortestRemainingPolicy::Next(void) {
+  return ready.empty() ? 0 : ready.begin()->second;
+}
+
+void ShortestRemainingPolicy::Ran(int id, const SliceStats &stats) {
+  auto found = remaining.find(id);
+  if (found == remaining.end()) {
+    return;
+  }
+  ready.erase(std::make_pair(found->second, id));
+  if (stats.terminated) {
+    remaining.erase(found);
+  } else {
+    found->second -= stats.lines;
+    ready.insert(std::make_pair(found->second, id));
+  }
+}
+
+int FaultAwarePolicy::Next(void) {
+  if (current == nullptr) {
+    current = queue.front();
+  }
+  if (current == nullptr) {
+    return 0;
+  }
+  // Pass over processes sitting out a round; each pass over the queue
+  // reduces every count, so this ends within kMaxSkip passes
+  while (current->skip > 0) {
+    --current->skip;
+    current = RunQueue<Entry>::Next(current);
+  }
+  return current->id;
+}
+
+void FaultAwarePolicy::Ran(int id, const SliceStats &stats) {
+  Entry *entry = Find(id);
+  if (entry != nullptr && !stats.terminated) {
+    entry->skip = std::min<long>(kMaxSkip, stats.pages_allocated / kPagesPerSkip);
+  }
+  RoundRobinPolicy::Ran(id, stats);
+}
+
+int AdaptiveSlicePolicy::TimeSlice(int id) {
+  Entry *entry = Find(id);
+  return entry != nullptr ? entry->slice : time_slice;
+}
+
+void AdaptiveSlicePolicy::Ran(int id, const SliceStats &stats) {
+  Entry *entry = Find(id);
+  if (entry != nullptr && !stats.terminated) {
+    long max_slice = std::min<long>(INT_MAX,
+            static_cast<long>(time_slice) * kMaxSliceGrowth);
+    entry->slice = stats.pages_allocated == 0
+            ? std::min<long>(2l * entry->slice, max_slice) : time_slice;
+  }
+  RoundRobinPolicy::Ran(id, stats);
+}
@@ -0,0 +1,189 @@
+/*
+ * SchedulingPolicy - decides which process the Scheduler runs next, and for
+ * how many lines.
+ *
+ * A policy knows processes only by process number. The scheduler adds every
+ * process, then repeatedly asks Next for the process to run and TimeSlice for
+ * the length of its slice, and reports what the slice did with Ran. The
+ * length of a process's slices may depend only on that process's own
+ * history, never on other processes. The parallel scheduler relies on this:
+ * a worker computes the slices of its processes with its own policy object,
+ * while the main thread replays the order with another.
+ *
+ * Policies (names as given to Create):
+ *   rr        round-robin with a fixed time slice
+ *   srl       shortest remaining lines first, from the line count of each
+ *             trace
+ *   fault     round-robin, but a process which allocated many pages in its
+ *             last slice sits out rounds in proportion, so processes
+ *             thrashing the allocator don't monopolize memory
+ *   adaptive  round-robin; the slice of a process doubles after each slice
+ *             with no page allocations (up to kMaxSliceGrowth times the time
+ *             slice), and drops back to the time slice after one with
+ *             allocations
+ */
+
+/*
+ * File:   SchedulingPolicy.h
+ */
+
+#ifndef SCHEDULINGPOLICY_H
+#define SCHEDULINGPOLICY_H
+
+#include "RunQueue.h"
+
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+class SchedulingPolicy {
+public:
+  /**
+   * SliceStats - what a time slice of a process did
+   */
+  struct SliceStats {
+    long lines;            // lines executed in the slice
+    long pages_allocated;  // data pages allocated in the slice
+    bool terminated;       // process terminated during the slice
+  };
+
+  /**
+   * Constructor
+   *
+   * @param time_slice_ base number of lines per time slice
+   */
+  SchedulingPolicy(int time_slice_) : time_slice(time_slice_) {}
+  virtual ~SchedulingPolicy() {}
+
+  // Disallow copy/move
+  SchedulingPolicy(const SchedulingPolicy &other) = delete;
+  SchedulingPolicy(SchedulingPolicy &&other) = delete;
+  SchedulingPolicy &operator=(const SchedulingPolicy &other) = delete;
+  SchedulingPolicy &operator=(SchedulingPolicy &&other) = delete;
+
+  /**
+   * Create - create a policy by name
+   *
+   * @param name policy name (see above)
+   * @param time_slice base number of lines per time slice
+   * @return the policy, or null if name is not a policy
+   */
+  static std::unique_ptr<SchedulingPolicy> Create(const std::string &name,
+                                                  int time_slice);
+
+  /**
+   * NeedsLineCounts - true if Add must be given the line count of each trace
+   */
+  virtual bool NeedsLineCounts(void) const { return false; }
+
+  /**
+   * Add - add a process
+   *
+   * @param id process number
+   * @param line_count number of lines in the trace (0 unless
+   *   NeedsLineCounts)
+   */
+  virtual void Add(int id, long line_count) = 0;
+
+  /**
+   * Next - choose the next process to run
+   *
+   * @return process number, or 0 if no processes remain
+   */
+  virtual int Next(void) = 0;
+
+  /**
+   * TimeSlice - number of lines for the next slice of a process
+   */
+  virtual int TimeSlice(int) { return time_slice; }
+
+  /**
+   * Ran - report a time slice of a process. A process which terminated is
+   *   removed.
+   *
+   * @param id process number
+   * @param stats what the slice did
+   */
+  virtual void Ran(int id, const SliceStats &stats) = 0;
+
+protected:
+  int time_slice;
+};
+
+/*
+ * RoundRobinPolicy - run processes in turn in the order they were added
+ */
+class RoundRobinPolicy : public SchedulingPolicy {
+public:
+  RoundRobinPolicy(int time_slice_)
+  : SchedulingPolicy(time_slice_), current(nullptr) {}
+
+  void Add(int id, long line_count) override;
+  int Next(void) override;
+  void Ran(int id, const SliceStats &stats) override;
+
+protected:
+  struct Entry : public RunQueueNode {
+    int id;
+    int skip;   // rounds still to sit out (FaultAwarePolicy)
+    int slice;  // lines in next time slice (AdaptiveSlicePolicy)
+  };
+  Entry *Find(int id);
+
+  RunQueue<Entry> queue;
+  Entry *current;  // next to run
+  std::unordered_map<int, std::unique_ptr<Entry>> entries;
+};
+
+/*
+ * ShortestRemainingPolicy - run the process with the fewest lines left
+ */
+class ShortestRemainingPolicy : public SchedulingPolicy {
+public:
+  ShortestRemainingPolicy(int time_slice_) : SchedulingPolicy(time_slice_) {}
+
+  bool NeedsLineCounts(void) const override { return true; }
+  void Add(int id, long line_count) override;
+  int Next(void) override;
+  void Ran(int id, const SliceStats &stats) override;
+
+private:
+  // (remaining lines, id) of each process, and remaining lines by id
+  std::set<std::pair<long, int>> ready;
+  std::unordered_map<int, long> remaining;
+};
+
+/*
+ * FaultAwarePolicy - round-robin, rate limiting processes which allocate
+ *   many pages
+ */
+class FaultAwarePolicy : public RoundRobinPolicy {
+public:
+  FaultAwarePolicy(int time_slice_) : RoundRobinPolicy(time_slice_) {}
+
+  int Next(void) override;
+  void Ran(int id, const SliceStats &stats) override;
+
+  // A process sits out one round per kPagesPerSkip pages allocated in a
+  // slice, up to kMaxSkip rounds
+  static const int kPagesPerSkip = 4;
+  static const int kMaxSkip = 8;
+};
+
+/*
+ * AdaptiveSlicePolicy - round-robin, with longer slices for processes which
+ *   don't allocate pages
+ */
+class AdaptiveSlicePolicy : public RoundRobinPolicy {
+public:
+  AdaptiveSlicePolicy(int time_slice_) : RoundRobinPolicy(time_slice_) {}
+
+  int TimeSlice(int id) override;
+  void Ran(int id, const SliceStats &stats) override;
+
+  static const int kMaxSliceGrowth = 16;
+};
+
+#endif /* SCHEDULINGPOLICY_H */
@@ -0,0 +1,293 @@
+/*
+ * SimulatorStats implementation
+ */
+
+/*
+ * File:   SimulatorStats.cpp
+ */
+
+#include "SimulatorStats.h"
+
+#include <MMU.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <string>
+
+using namespace trace_format;
+
+namespace {
+/*
+ * CommandName - name of a command type in the report
+ */
+const char *CommandName(int op) {
+  return op == kOpComment ? "comment" : OpcodeName(static_cast<TraceOpcode>(op));
+}
+
+/*
+ * Milliseconds - nanoseconds as fractional milliseconds
+ */
+double Milliseconds(uint64_t ns) {
+  return ns / 1e6;
+}
+
+/*
+ * WriteLatencyRow - write a histogram as a row of the latency table
+ */
+void WriteLatencyRow(std::ostream &out, const char *name,
+                     const LatencyHistogram &h) {
+  out << "  " << std::left << std::setw(10) << name << std::right
+      << std::setw(12) << h.count << std::setw(12) << h.Percentile(0.5)
+      << std::setw(12) << h.Percentile(0.9) << std::setw(12)
+      << h.Percentile(0.99) << std::setw(14) << h.max_ns << "\n";
+}
+
+/*
+ * WriteLatencyJson - write a histogram as a JSON object; buckets are listed
+ *   up to the last one used
+ */
+void WriteLatencyJson(std::ostream &out, const LatencyHistogram &h) {
+  out << "{\"count\": " << h.count << ", \"total_ns\": " << h.total_ns
+      << ", \"max_ns\": " << h.max_ns << ", \"p50_ns\": " << h.Percentile(0.5)
+      << ", \"p99_ns\": " << h.Percentile(0.99) << ", \"buckets\": [";
+  unsigned used = LatencyHistogram::kBuckets;
+  while (used > 0 && h.buckets[used - 1] == 0) {
+    --used;
+  }
+  for (unsigned b = 0; b < used; ++b) {
+    out << (b ? ", " : "") << h.buckets[b];
+  }
+  out << "]}";
+}
+
+/*
+ * WriteProcessJson - write the counters of a process as JSON members
+ */
+void WriteProcessJson(std::ostream &out, const ProcessStats &p) {
+  out << "\"lines\": {";
+  for (int op = 0; op < kOpCount; ++op) {
+    out << (op ? ", " : "") << '"' << CommandName(op) << "\": " << p.lines[op];
+  }
+  out << "}, \"bytes\": {";
+  for (int op = 0; op < kOpCount; ++op) {
+    out << (op ? ", " : "") << '"' << CommandName(op) << "\": " << p.bytes[op];
+  }
+  out << "}, \"page_faults\": " << p.page_faults
+      << ", \"regions_mapped\": " << p.regions_mapped
+      << ", \"read_faults\": " << p.read_faults
+      << ", \"write_faults\": " << p.write_faults
+      << ", \"pte_lookups\": " << p.pte_lookups
+      << ", \"pte_lookup_misses\": " << p.pte_lookup_misses
+      << ", \"quota_terminations\": " << p.quota_terminations
+      << ", \"pmcb_switches\": " << p.pmcb_switches
+      << ", \"shared_pages\": " << p.shared_pages
+      << ", \"cow_copies\": " << p.cow_copies
+      << ", \"swap_ins\": " << p.swap_ins
+      << ", \"swap_outs\": " << p.swap_outs
+      << ", \"swap_writes\": " << p.swap_writes
+      << ", \"quanta\": " << p.quanta
+      << ", \"wall_ns\": " << p.wall_ns
+      << ", \"cpu_ns\": " << p.cpu_ns
+      << ", \"max_quantum_wall_ns\": " << p.max_quantum_wall_ns;
+  if (kLatencyProfiling) {
+    out << ", \"latency\": {";
+    for (int op = 0; op < kOpCount; ++op) {
+      out << '"' << CommandName(op) << "\": ";
+      WriteLatencyJson(out, p.command_latency[op]);
+      out << ", ";
+    }
+    out << "\"map_page\": ";
+    WriteLatencyJson(out, p.map_page_latency);
+    out << "}";
+  }
+}
+}
+
+void ProcessStats::Add(const ProcessStats &other) {
+  for (int op = 0; op < kOpCount; ++op) {
+    lines[op] += other.lines[op];
+    bytes[op] += other.bytes[op];
+    command_latency[op].Add(other.command_latency[op]);
+  }
+  map_page_latency.Add(other.map_page_latency);
+  page_faults += other.page_faults;
+  regions_mapped += other.regions_mapped;
+  read_faults += other.read_faults;
+  write_faults += other.write_faults;
+  pte_lookups += other.pte_lookups;
+  pte_lookup_misses += other.pte_lookup_misses;
+  quota_terminations += other.quota_terminations;
+  pmcb_switches += other.pmcb_switches;
+  shared_pages += other.shared_pages;
+  cow_copies += other.cow_copies;
+  swap_ins += other.swap_ins;
+  swap_outs += other.swap_outs;
+  swap_writes += other.swap_writes;
+  quanta += other.quanta;
+  wall_ns += other.wall_ns;
+  cpu_ns += other.cpu_ns;
+  max_quantum_wall_ns = std::max(max_quantum_wall_ns, other.max_quantum_wall_ns);
+}
+
+uint64_t ProcessStats::TotalLines(void) const {
+  uint64_t total = 0;
+  for (int op = 0; op < kOpCount; ++op) {
+    total += lines[op];
+  }
+  return total;
+}
+
+void AllocatorStats::Add(const AllocatorStats &other) {
+  frames_allocated += other.frames_allocated;
+  frames_freed += other.frames_freed;
+  frames_in_use += other.frames_in_use;
+  peak_frames_in_use += other.peak_frames_in_use;
+  failed_allocations += other.failed_allocations;
+  contiguous_allocations += other.contiguous_allocations;
+  failed_contiguous += other.failed_contiguous;
+  free_frames += other.free_frames;
+  free_blocks += other.free_blocks;
+  free_max_blocks += other.free_max_blocks;
+  allocate_latency.Add(other.allocate_latency);
+}
+
+void WriteStatsTable(std::ostream &out, const SchedulerStats &scheduler,
+                     const AllocatorStats &allocator,
+                     const std::vector<ProcessStats> &processes) {
+  ProcessStats total;
+  for (const ProcessStats &p : processes) {
+    total.Add(p);
+  }
+  std::ios_base::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(3);
+
+  out << "scheduler: " << scheduler.threads << " thread(s), "
+      << scheduler.processes << " processes, " << scheduler.quanta
+      << " quanta, " << Milliseconds(scheduler.wall_ns) << " ms wall\n"
+      << "  pmcb switches " << scheduler.pmcb_switches
+      << ", skipped " << scheduler.pmcb_switches_skipped
+      << "; trace bytes prefetched " << scheduler.bytes_prefetched << "\n"
+      << "allocator: " << allocator.frames_allocated << " frames allocated, "
+      << allocator.frames_freed << " freed, " << allocator.frames_in_use
+      << " in use, peak " << allocator.peak_frames_in_use << ", "
+      << allocator.failed_allocations << " failed allocations\n"
+      << "  contiguous blocks " << allocator.contiguous_allocations
+      << " allocated, " << allocator.failed_contiguous << " failed; free "
+      << allocator.free_frames << " frames in " << allocator.free_blocks
+      << " blocks, " << allocator.free_max_blocks << " of "
+      << mem::kPageTableEntries << " frames\n";
+
+  out << "commands:\n"
+      << "  " << std::left << std::setw(10) << "command" << std::right
+      << std::setw(14) << "lines" << std::setw(16) << "bytes" << "\n";
+  for (int op = 0; op < kOpCount; ++op) {
+    out << "  " << std::left << std::setw(10) << CommandName(op) << std::right
+        << std::setw(14) << total.lines[op] << std::setw(16) << total.bytes[op]
+        << "\n";
+  }
+  out << "faults: " << total.page_faults << " page faults serviced ("
+      << total.regions_mapped << " whole regions), "
+      << total.read_faults << " read faults, " << total.write_faults
+      << " write permission faults, " << total.quota_terminations
+      << " quota terminations\n"
+      << "page tables: " << total.pte_lookups << " entries looked up in the "
+      << "shadow tables, " << total.pte_lookup_misses << " with no L2 table\n"
+      << "sharing: " << total.shared_pages << " pages mapped to shared frames, "
+      << total.cow_copies << " copied on write\n"
+      << "swap: " << total.swap_ins << " pages in ("
+      << total.swap_ins * mem::kPageSize << " bytes), " << total.swap_outs
+      << " out, " << total.swap_writes << " written ("
+      << total.swap_writes * mem::kPageSize << " bytes)\n"
+      << "time: " << Milliseconds(total.wall_ns) << " ms wall, "
+      << Milliseconds(total.cpu_ns) << " ms cpu, longest quantum "
+      << Milliseconds(total.max_quantum_wall_ns) << " ms\n";
+  if (kLatencyProfiling) {
+    // Percentiles are bucket bounds (see LatencyProfile.h)
+    out << "latency:\n"
+        << "  " << std::left << std::setw(10) << "ns" << std::right
+        << std::setw(12) << "count" << std::setw(12) << "p50"
+        << std::setw(12) << "p90" << std::setw(12) << "p99"
+        << std::setw(14) << "max" << "\n";
+    for (int op = 0; op < kOpCount; ++op) {
+      WriteLatencyRow(out, CommandName(op), total.command_latency[op]);
+    }
+    WriteLatencyRow(out, "map page", total.map_page_latency);
+    WriteLatencyRow(out, "allocate", allocator.allocate_latency);
+    WriteLatencyRow(out, "switch", scheduler.switch_latency);
+  }
+
+  out << "processes:\n"
+      << std::setw(8) << "id" << std::setw(12) << "lines"
+      << std::setw(10) << "faults" << std::setw(10) << "quanta"
+      << std::setw(10) << "pmcb" << std::setw(12) << "wall ms"
+      << std::setw(12) << "cpu ms" << "\n";
+  for (const ProcessStats &p : processes) {
+    out << std::setw(8) << p.id << std::setw(12) << p.TotalLines()
+        << std::setw(10) << p.page_faults << std::setw(10) << p.quanta
+        << std::setw(10) << p.pmcb_switches
+        << std::setw(12) << Milliseconds(p.wall_ns)
+        << std::setw(12) << Milliseconds(p.cpu_ns) << "\n";
+  }
+  if (kLatencyProfiling) {
+    // Every command of each process together
+    out << "process latency:\n"
+        << "  " << std::left << std::setw(10) << "id" << std::right
+        << std::setw(12) << "commands" << std::setw(12) << "p50"
+        << std::setw(12) << "p90" << std::setw(12) << "p99"
+        << std::setw(14) << "max" << "\n";
+    for (const ProcessStats &p : processes) {
+      LatencyHistogram commands;
+      for (int op = 0; op < kOpCount; ++op) {
+        commands.Add(p.command_latency[op]);
+      }
+      WriteLatencyRow(out, std::to_string(p.id).c_str(), commands);
+    }
+  }
+  out.flags(flags);
+}
+
+void WriteStatsJson(std::ostream &out, const SchedulerStats &scheduler,
+                    const AllocatorStats &allocator,
+                    const std::vector<ProcessStats> &processes) {
+  ProcessStats total;
+  for (const ProcessStats &p : processes) {
+    total.Add(p);
+  }
+
+  out << "{\"scheduler\": {\"threads\": " << scheduler.threads
+      << ", \"processes\": " << scheduler.processes
+      << ", \"quanta\": " << scheduler.quanta
+      << ", \"pmcb_switches\": " << scheduler.pmcb_switches
+      << ", \"pmcb_switches_skipped\": " << scheduler.pmcb_switches_skipped
+      << ", \"bytes_prefetched\": " << scheduler.bytes_prefetched
+      << ", \"wall_ns\": " << scheduler.wall_ns;
+  if (kLatencyProfiling) {
+    out << ", \"switch_latency\": ";
+    WriteLatencyJson(out, scheduler.switch_latency);
+  }
+  out << "},\n"
+      << " \"allocator\": {\"frames_allocated\": " << allocator.frames_allocated
+      << ", \"frames_freed\": " << allocator.frames_freed
+      << ", \"frames_in_use\": " << allocator.frames_in_use
+      << ", \"peak_frames_in_use\": " << allocator.peak_frames_in_use
+      << ", \"failed_allocations\": " << allocator.failed_allocations
+      << ", \"contiguous_allocations\": " << allocator.contiguous_allocations
+      << ", \"failed_contiguous\": " << allocator.failed_contiguous
+      << ", \"free_frames\": " << allocator.free_frames
+      << ", \"free_blocks\": " << allocator.free_blocks
+      << ", \"free_max_blocks\": " << allocator.free_max_blocks;
+  if (kLatencyProfiling) {
+    out << ", \"allocate_latency\": ";
+    WriteLatencyJson(out, allocator.allocate_latency);
+  }
+  out << "},\n"
+      << " \"totals\": {";
+  WriteProcessJson(out, total);
+  out << "},\n \"processes\": [";
+  for (size_t i = 0; i < processes.size(); ++i) {
+    out << (i ? ",\n  " : "\n  ") << "{\"id\": " << processes[i].id << ", ";
+    WriteProcessJson(out, processes[i]);
+    out << "}";
+  }
+  out << "]}\n";
+}
@@ -0,0 +1,120 @@
+/*
+ * SimulatorStats - performance counters of processes, page frame allocators
+ * and the scheduler, and the --stats report.
+ *
+ * Counters are plain integers updated by the object they describe (each
+ * ProcessTrace and PageFrameAllocator is only used by one thread at a time),
+ * and are added up by the Scheduler when the run is over. Times are in
+ * nanoseconds: wall time from std::chrono::steady_clock, CPU time from the
+ * CPU clock of the thread running the process.
+ */
+
+/*
+ * File:   SimulatorStats.h
+ */
+
+#ifndef SIMULATORSTATS_H
+#define SIMULATORSTATS_H
+
+#include "LatencyProfile.h"
+#include "TraceFormat.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * ProcessStats - counters of one process
+ */
+struct ProcessStats {
+  int id = 0;                                 // process number
+  uint64_t lines[trace_format::kOpCount] = {};  // lines executed, by command
+  uint64_t bytes[trace_format::kOpCount] = {};  // bytes read or written
+  uint64_t page_faults = 0;         // missing pages allocated on demand
+  uint64_t regions_mapped = 0;      // of those, whole L2 regions mapped at once
+  uint64_t read_faults = 0;         // page faults reported by compare, copy, dump
+  uint64_t write_faults = 0;        // write permission faults reported
+  uint64_t pte_lookups = 0;         // L2 entries read from the shadow tables
+  uint64_t pte_lookup_misses = 0;   // of those, with no L2 table
+  uint64_t quota_terminations = 0;  // 1 if terminated for exceeding quota
+  uint64_t pmcb_switches = 0;       // PMCB loads done by the process
+  uint64_t shared_pages = 0;        // pages mapped to shared frames (--dedup)
+  uint64_t cow_copies = 0;          // shared frames copied on write
+  uint64_t swap_ins = 0;            // pages read back from swap (--swap)
+  uint64_t swap_outs = 0;           // pages evicted
+  uint64_t swap_writes = 0;         // evicted pages written to swap
+  uint64_t quanta = 0;              // time slices run
+  uint64_t wall_ns = 0;             // wall time running (if timed)
+  uint64_t cpu_ns = 0;              // CPU time running (if timed)
+  uint64_t max_quantum_wall_ns = 0; // longest time slice (if timed)
+  // Latency of each command handler, by command (a put or compare merged
+  // with the records after it counts once), and of mapping a page on
+  // demand; empty unless kLatencyProfiling
+  LatencyHistogram command_latency[trace_format::kOpCount];
+  LatencyHistogram map_page_latency;
+
+  /**
+   * Add - add the counters of another process (keeping the larger maximum)
+   */
+  void Add(const ProcessStats &other);
+
+  /**
+   * TotalLines - lines executed of all command types
+   */
+  uint64_t TotalLines(void) const;
+};
+
+/**
+ * AllocatorStats - counters of a page frame allocator
+ */
+struct AllocatorStats {
+  uint64_t frames_allocated = 0;
+  uint64_t frames_freed = 0;
+  uint64_t frames_in_use = 0;
+  uint64_t peak_frames_in_use = 0;  // sum of peaks when added
+  uint64_t failed_allocations = 0;
+  uint64_t contiguous_allocations = 0;  // blocks allocated whole
+  uint64_t failed_contiguous = 0;       // block allocations failed
+  // Fragmentation at the time of the report: free frames, the free buddy
+  // blocks holding them, and how many blocks are of the largest order
+  uint64_t free_frames = 0;
+  uint64_t free_blocks = 0;
+  uint64_t free_max_blocks = 0;
+  LatencyHistogram allocate_latency;  // of Allocate (if kLatencyProfiling)
+
+  void Add(const AllocatorStats &other);
+};
+
+/**
+ * SchedulerStats - counters of the scheduler
+ */
+struct SchedulerStats {
+  int threads = 1;
+  uint64_t processes = 0;
+  uint64_t quanta = 0;
+  uint64_t pmcb_switches = 0;          // PMCB loads done
+  uint64_t pmcb_switches_skipped = 0;  // PMCB loads found redundant
+  uint64_t bytes_prefetched = 0;       // trace bytes read ahead
+  uint64_t wall_ns = 0;                // wall time of Execute
+  // Time between time slices, from the end of one to the start of the
+  // next (if kLatencyProfiling)
+  LatencyHistogram switch_latency;
+};
+
+/**
+ * WriteStatsTable, WriteStatsJson - write the --stats report as a table
+ *   for reading, or as a JSON object
+ *
+ * @param out destination of report
+ * @param scheduler scheduler counters
+ * @param allocator allocator counters (all allocators added)
+ * @param processes counters of each process, by process number
+ */
+void WriteStatsTable(std::ostream &out, const SchedulerStats &scheduler,
+                     const AllocatorStats &allocator,
+                     const std::vector<ProcessStats> &processes);
+void WriteStatsJson(std::ostream &out, const SchedulerStats &scheduler,
+                    const AllocatorStats &allocator,
+                    const std::vector<ProcessStats> &processes);
+
+#endif /* SIMULATORSTATS_H */
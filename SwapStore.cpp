@@ -0,0 +1,73 @@
+/*
+ * SwapStore implementation
+ */
+
+/*
+ * File:   SwapStore.cpp
+ */
+
+#include "SwapStore.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using std::cerr;
+
+SwapStore::SwapStore(const std::string &file_name_)
+: file_name(file_name_), fd(-1), data(nullptr), slots(0), high_water(0) {
+  fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    cerr << "ERROR: failed to create swap file: " << file_name << "\n";
+    exit(2);
+  }
+  unlink(file_name.c_str());
+}
+
+SwapStore::~SwapStore() {
+  if (data != nullptr) {
+    munmap(data, static_cast<size_t>(slots) * mem::kPageSize);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+uint32_t SwapStore::Allocate(void) {
+  if (!free_slots.empty()) {
+    uint32_t slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+  }
+  if (high_water == slots) {
+    Grow();
+  }
+  return high_water++;
+}
+
+void SwapStore::Free(uint32_t slot) {
+  free_slots.push_back(slot);
+}
+
+void SwapStore::Grow(void) {
+  uint32_t new_slots = slots == 0 ? kInitialSlots : 2 * slots;
+  size_t new_size = static_cast<size_t>(new_slots) * mem::kPageSize;
+  if (ftruncate(fd, new_size) != 0) {
+    cerr << "ERROR: failed to extend swap file: " << file_name << "\n";
+    exit(2);
+  }
+  if (data != nullptr) {
+    munmap(data, static_cast<size_t>(slots) * mem::kPageSize);
+  }
+  void *mapped = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  if (mapped == MAP_FAILED) {
+    cerr << "ERROR: failed to map swap file: " << file_name << "\n";
+    exit(2);
+  }
+  data = static_cast<uint8_t*>(mapped);
+  slots = new_slots;
+}
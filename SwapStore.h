@@ -0,0 +1,89 @@
+/*
+ * SwapStore - backing store for pages evicted from simulated physical
+ * memory (see PageReplacer), kept in a memory mapped host file.
+ *
+ * The file is divided into page sized slots. Slots are allocated from a
+ * list of freed slots, then from the end of the file, which grows (and is
+ * mapped again) as needed. The file is created empty and removed at once,
+ * keeping only the open descriptor, since its contents mean nothing after
+ * the run: it is gone however the program exits.
+ */
+
+/*
+ * File:   SwapStore.h
+ */
+
+#ifndef SWAPSTORE_H
+#define SWAPSTORE_H
+
+#include <MMU.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class SwapStore {
+public:
+  /**
+   * Constructor - create the swap file. Reports an error to cerr and exits
+   *   if it can't be created.
+   *
+   * @param file_name_ host file to create (replaced if it exists)
+   */
+  SwapStore(const std::string &file_name_);
+
+  /**
+   * Destructor - unmap and close the swap file
+   */
+  virtual ~SwapStore();
+
+  // Disallow copy/move
+  SwapStore(const SwapStore &other) = delete;
+  SwapStore(SwapStore &&other) = delete;
+  SwapStore &operator=(const SwapStore &other) = delete;
+  SwapStore &operator=(SwapStore &&other) = delete;
+
+  /**
+   * Allocate - allocate a slot, growing the file if needed. Reports an
+   *   error to cerr and exits if the file can't grow.
+   *
+   * @return slot number
+   */
+  uint32_t Allocate(void);
+
+  /**
+   * Free - return a slot to the store
+   */
+  void Free(uint32_t slot);
+
+  /**
+   * Slot - contents of a slot (kPageSize bytes), valid until the next
+   *   Allocate
+   */
+  uint8_t *Slot(uint32_t slot) {
+    return data + static_cast<size_t>(slot) * mem::kPageSize;
+  }
+
+  // Number of slots in the file, and in use
+  uint32_t get_slots(void) const { return slots; }
+  uint32_t get_slots_used(void) const { return high_water - free_slots.size(); }
+
+  static const uint32_t kNoSlot = 0xFFFFFFFF;
+
+private:
+  std::string file_name;
+  int fd;
+  uint8_t *data;    // mapping of the whole file
+  uint32_t slots;   // slots in the file
+  uint32_t high_water;  // slots from here up have never been used
+  std::vector<uint32_t> free_slots;  // freed slots; the back is used next
+
+  static const uint32_t kInitialSlots = 256;
+
+  /**
+   * Grow - double the size of the file and map it again
+   */
+  void Grow(void);
+};
+
+#endif /* SWAPSTORE_H */
@@ -0,0 +1,199 @@
+/*
+ * TraceCompiler implementation
+ */
+
+/*
+ * File:   TraceCompiler.cpp
+ */
+
+#include "TraceCompiler.h"
+#include "TraceScanner.h"
+
+#include <cstdio>
+#include <iostream>
+
+using namespace trace_format;
+
+using std::cerr;
+using std::getline;
+using std::string;
+using std::vector;
+
+TraceCompiler::TraceCompiler(const string &in_file_name_,
+                             const string &out_file_name_)
+: in_file_name(in_file_name_), out_file_name(out_file_name_), line_number(0) {
+}
+
+bool TraceCompiler::Compile(void) {
+  // Write a temporary file and rename it only once it is complete, so a
+  // failed compile never leaves a valid but shorter trace behind
+  string tmp_file_name = out_file_name + ".tmp";
+  if (!CompileTo(tmp_file_name)) {
+    std::remove(tmp_file_name.c_str());
+    return false;
+  }
+  if (std::rename(tmp_file_name.c_str(), out_file_name.c_str()) != 0) {
+    cerr << "ERROR: failed to rename " << tmp_file_name << " to "
+         << out_file_name << "\n";
+    std::remove(tmp_file_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool TraceCompiler::CompileTo(const string &tmp_file_name) {
+  std::ifstream in(in_file_name);
+  if (!in.is_open()) {
+    cerr << "ERROR: failed to open trace file: " << in_file_name << "\n";
+    return false;
+  }
+  std::ofstream out(tmp_file_name, std::ios_base::out | std::ios_base::binary
+                                   | std::ios_base::trunc);
+  if (!out.is_open()) {
+    cerr << "ERROR: failed to create binary trace file: " << out_file_name
+         << "\n";
+    return false;
+  }
+
+  out.write(reinterpret_cast<const char*>(kBinaryTraceMagic),
+            kBinaryTraceMagicSize);
+
+  string line;
+  while (getline(in, line)) {
+    ++line_number;
+    if (!CompileLine(line)) {
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(record.data()), record.size());
+  }
+
+  if (!in.eof()) {
+    cerr << "ERROR: getline failed on trace file: " << in_file_name
+         << " at line " << line_number << "\n";
+    return false;
+  }
+  out.close();
+  if (!out) {
+    cerr << "ERROR: failed writing binary trace file: " << out_file_name
+         << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool TraceCompiler::CompileLine(const string &line) {
+  record.clear();
+
+  if (line.empty()) {
+    return LineError("empty line", line);
+  }
+
+  // Parse the line the same way ProcessTrace::ParseCommand does
+  string cmd;
+  vector<uint32_t> args;
+  if (line.at(0) != '#') {
+    const char *end = line.data() + line.size();
+    const char *p = SkipSpace(line.data(), end);
+    const char *cmd_end = ScanToken(p, end);
+    cmd.assign(p, cmd_end);
+    uint32_t arg;
+    p = cmd_end;
+    while ((p = ScanHex(p, end, arg)) != nullptr) {
+      args.push_back(arg);
+    }
+  }
+
+  TraceOpcode op = OpcodeFromName(cmd);
+
+  // Check argument counts
+  size_t min_args = 0;
+  switch (op) {
+    case kOpQuota:
+    case kOpCompare:
+    case kOpPut:
+      min_args = 1;
+      break;
+    case kOpDump:
+      min_args = 2;
+      break;
+    case kOpFill:
+    case kOpCopy:
+    case kOpWritable:
+      min_args = 3;
+      break;
+    default:
+      break;
+  }
+  if (args.size() < min_args) {
+    return LineError("missing arguments", line);
+  }
+
+  // Header: opcode and original text
+  record.push_back(op);
+  AppendVarint(line.size());
+  AppendBytes(reinterpret_cast<const uint8_t*>(line.data()), line.size());
+
+  // Operands
+  switch (op) {
+    case kOpQuota:
+      AppendVarint(args[0]);
+      break;
+    case kOpCompare:
+    case kOpPut:
+    {
+      AppendVarint(args[0]);
+      AppendVarint(args.size() - 1);
+      // put stores only the low byte; compare compares all 32 bits, so
+      // larger expected values are also listed whole after the bytes
+      vector<size_t> wide;
+      for (size_t i = 1; i < args.size(); ++i) {
+        if (op == kOpCompare && args[i] > 0xFF) {
+          wide.push_back(i - 1);
+        }
+        record.push_back(static_cast<uint8_t>(args[i]));
+      }
+      if (!wide.empty()) {
+        record[0] |= kWideValuesFlag;
+        AppendVarint(wide.size());
+        for (size_t index : wide) {
+          AppendVarint(index);
+          AppendVarint(args[index + 1]);
+        }
+      }
+      break;
+    }
+    case kOpFill:
+      AppendVarint(args[0]);
+      AppendVarint(args[1]);
+      record.push_back(static_cast<uint8_t>(args[2]));
+      break;
+    case kOpCopy:
+    case kOpWritable:
+      AppendVarint(args[0]);
+      AppendVarint(args[1]);
+      AppendVarint(args[2]);
+      break;
+    case kOpDump:
+      AppendVarint(args[0]);
+      AppendVarint(args[1]);
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+void TraceCompiler::AppendVarint(uint32_t value) {
+  uint8_t encoded[kMaxVarintSize];
+  AppendBytes(encoded, EncodeVarint(value, encoded));
+}
+
+void TraceCompiler::AppendBytes(const uint8_t *bytes, size_t count) {
+  record.insert(record.end(), bytes, bytes + count);
+}
+
+bool TraceCompiler::LineError(const string &message, const string &line) {
+  cerr << "ERROR: " << message << " at line " << line_number << " of "
+       << in_file_name << ":\n" << line << "\n";
+  return false;
+}
@@ -0,0 +1,93 @@
+/*
+ * TraceCompiler - convert a text memory trace (see ProcessTrace.h) to the
+ * binary trace format described in TraceFormat.h.
+ *
+ * Each text line is parsed once, exactly as ProcessTrace parses it, and
+ * written as one binary record holding the opcode, the original line text
+ * (so the echoed output is unchanged) and the decoded operands. Lines that
+ * would fail when executed (missing arguments, empty lines) are reported at
+ * compile time instead.
+ */
+
+/*
+ * File:   TraceCompiler.h
+ */
+
+#ifndef TRACECOMPILER_H
+#define TRACECOMPILER_H
+
+#include "TraceFormat.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+class TraceCompiler {
+public:
+  /**
+   * Constructor
+   *
+   * @param in_file_name_ text trace to read
+   * @param out_file_name_ binary trace to write
+   */
+  TraceCompiler(const std::string &in_file_name_,
+                const std::string &out_file_name_);
+
+  virtual ~TraceCompiler() {}
+
+  // Disallow copy/move
+  TraceCompiler(const TraceCompiler &other) = delete;
+  TraceCompiler(TraceCompiler &&other) = delete;
+  TraceCompiler &operator=(const TraceCompiler &other) = delete;
+  TraceCompiler &operator=(TraceCompiler &&other) = delete;
+
+  /**
+   * Compile - convert the whole input trace. The output file is created
+   *   (or replaced) only if the whole trace compiles.
+   *
+   * @return true if success, false if an error was reported to cerr
+   */
+  bool Compile(void);
+
+private:
+  std::string in_file_name;
+  std::string out_file_name;
+  long line_number;
+
+  // Encoded bytes of the current record
+  std::vector<uint8_t> record;
+
+  /**
+   * CompileTo - convert the whole input trace into a file
+   *
+   * @param tmp_file_name file to write (replaced if it exists)
+   * @return true if success, false if an error was reported to cerr
+   */
+  bool CompileTo(const std::string &tmp_file_name);
+
+  /**
+   * CompileLine - encode one text line into record
+   *
+   * @param line text of line
+   * @return true if success, false if the line can't be encoded
+   */
+  bool CompileLine(const std::string &line);
+
+  /**
+   * Append helpers for record
+   */
+  void AppendVarint(uint32_t value);
+  void AppendBytes(const uint8_t *bytes, size_t count);
+
+  /**
+   * LineError - report an error in the input trace
+   *
+   * @param message description of error
+   * @param line text of line
+   * @return false
+   */
+  bool LineError(const std::string &message, const std::string &line);
+};
+
+#endif /* TRACECOMPILER_H */
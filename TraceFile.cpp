@@ -0,0 +1,91 @@
+/*
+ * TraceFile implementation
+ */
+
+/*
+ * File:   TraceFile.cpp
+ */
+
+#include "TraceFile.h"
+
+#include <cstdlib>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::string;
+
+std::map<TraceFile::FileKey, std::weak_ptr<TraceFile>> TraceFile::mappings;
+std::mutex TraceFile::mappings_mutex;
+
+std::shared_ptr<TraceFile> TraceFile::Open(const string &file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    cerr << "ERROR: failed to open trace file: " << file_name << "\n";
+    exit(2);
+  }
+  FileKey key(file_stat.st_dev, file_stat.st_ino);
+
+  std::lock_guard<std::mutex> lock(mappings_mutex);
+
+  // Share existing mapping if there is one
+  auto existing = mappings.find(key);
+  if (existing != mappings.end()) {
+    std::shared_ptr<TraceFile> trace_file = existing->second.lock();
+    if (trace_file) {
+      close(fd);
+      return trace_file;
+    }
+  }
+
+  // Map the whole file (an empty file needs no mapping)
+  size_t size = file_stat.st_size;
+  const char *data = nullptr;
+  if (size > 0) {
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      cerr << "ERROR: failed to map trace file: " << file_name << "\n";
+      exit(2);
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(mapped);
+  }
+  close(fd);
+
+  std::shared_ptr<TraceFile> trace_file(new TraceFile(key, data, size));
+  mappings[key] = trace_file;
+  return trace_file;
+}
+
+size_t TraceFile::Check(const string &file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    cerr << "ERROR: failed to open trace file: " << file_name << "\n";
+    exit(2);
+  }
+  close(fd);
+  return file_stat.st_size;
+}
+
+TraceFile::TraceFile(FileKey key_, const char *data_, size_t size_)
+: key(key_), data(data_), size(size_) {
+}
+
+TraceFile::~TraceFile() {
+  if (data != nullptr) {
+    munmap(const_cast<char*>(data), size);
+  }
+
+  // Remove registry entry unless the file has already been mapped again
+  std::lock_guard<std::mutex> lock(mappings_mutex);
+  auto entry = mappings.find(key);
+  if (entry != mappings.end() && entry->second.expired()) {
+    mappings.erase(entry);
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * TraceFile - read-only memory mapping of a trace file.
+ *
+ * The whole file is mapped and the file descriptor is closed immediately, so
+ * an open trace uses no file descriptor. Mappings are shared: opening a file
+ * that is already mapped (the same file may be given several times on the
+ * command line) returns the existing mapping, which is unmapped when the
+ * last user releases it.
+ */
+
+/*
+ * File:   TraceFile.h
+ */
+
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+class TraceFile {
+public:
+  /**
+   * Open - get the mapping of a trace file, mapping it if not already mapped.
+   *   Aborts program if the file can't be opened or mapped.
+   *
+   * @param file_name name of trace file
+   * @return shared mapping of the file
+   */
+  static std::shared_ptr<TraceFile> Open(const std::string &file_name);
+
+  /**
+   * Check - check that a trace file can be opened, without mapping it or
+   *   keeping it open. Aborts program if it can't, as Open does.
+   *
+   * @param file_name name of trace file
+   * @return size of the file in bytes
+   */
+  static size_t Check(const std::string &file_name);
+
+  /**
+   * Destructor - unmap file
+   */
+  virtual ~TraceFile();
+
+  // Disallow copy/move
+  TraceFile(const TraceFile &other) = delete;
+  TraceFile(TraceFile &&other) = delete;
+  TraceFile &operator=(const TraceFile &other) = delete;
+  TraceFile &operator=(TraceFile &&other) = delete;
+
+  // Access to mapped contents
+  const char *begin(void) const { return data; }
+  const char *end(void) const { return data + size; }
+  size_t get_size(void) const { return size; }
+
+private:
+  // File identity (device, inode), key of the mapping registry
+  typedef std::pair<uint64_t, uint64_t> FileKey;
+
+  TraceFile(FileKey key_, const char *data_, size_t size_);
+
+  FileKey key;
+  const char *data;
+  size_t size;
+
+  // All current mappings, so repeated opens of a file share one mapping
+  static std::map<FileKey, std::weak_ptr<TraceFile>> mappings;
+  static std::mutex mappings_mutex;
+};
+
+#endif /* TRACEFILE_H */
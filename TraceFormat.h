@@ -0,0 +1,214 @@
+/*
+ * TraceFormat - definitions shared by the text-to-binary trace compiler and
+ * the binary trace reader in ProcessTrace.
+ *
+ * A binary trace file starts with the 4 byte magic number kBinaryTraceMagic,
+ * followed by one record per line of the original text trace:
+ *
+ *   opcode      1 byte (TraceOpcode, with kWideValuesFlag set on a compare
+ *               which has expected values that don't fit in a byte)
+ *   line_length varint
+ *   line_text   line_length raw bytes (original text, echoed to output)
+ *   operands    depend on opcode:
+ *     quota     pages
+ *     compare   addr count, followed by count raw expected bytes (the low
+ *               bytes of wide values); with kWideValuesFlag, followed by
+ *               wide_count and wide_count pairs of index and value
+ *     put       addr count, followed by count raw value bytes
+ *     fill      addr count, followed by 1 raw value byte
+ *     copy      dest_addr src_addr count
+ *     dump      addr count
+ *     writable  vaddr size status
+ *     comment and invalid records have no operands
+ *
+ * All varints are unsigned little-endian base 128 (7 data bits per byte,
+ * high bit set on every byte except the last).
+ */
+
+/*
+ * File:   TraceFormat.h
+ */
+
+#ifndef TRACEFORMAT_H
+#define TRACEFORMAT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace trace_format {
+
+// Magic number at start of a binary trace. The leading 0x7f can't start a
+// line of a text trace, so the first 4 bytes identify the format.
+const uint8_t kBinaryTraceMagic[4] = { 0x7f, 'P', 'T', 'B' };
+const size_t kBinaryTraceMagicSize = sizeof(kBinaryTraceMagic);
+
+// Maximum number of bytes in an encoded 32 bit varint
+const size_t kMaxVarintSize = 5;
+
+/**
+ * TraceOpcode - record type of a binary trace record
+ */
+enum TraceOpcode : uint8_t {
+  kOpComment = 0,   // comment or blank command, echoed only
+  kOpQuota,
+  kOpCompare,
+  kOpPut,
+  kOpFill,
+  kOpCopy,
+  kOpDump,
+  kOpWritable,
+  kOpInvalid,       // unrecognized command, reported when executed
+  kOpCount          // number of opcodes (not a valid opcode)
+};
+
+// Flag in the opcode byte of a compare record followed by wide values
+const uint8_t kWideValuesFlag = 0x80;
+
+/**
+ * OpcodeName - command name used in text traces for an opcode
+ *
+ * @param op opcode
+ * @return command name; empty for comments, "invalid" for invalid records
+ */
+inline const char *OpcodeName(TraceOpcode op) {
+  static const char *const kNames[kOpCount] = {
+    "", "quota", "compare", "put", "fill", "copy", "dump", "writable",
+    "invalid"
+  };
+  return op < kOpCount ? kNames[op] : kNames[kOpInvalid];
+}
+
+/**
+ * OpcodeFromName - decode a text trace command name
+ *
+ * @param cmd command name (case sensitive)
+ * @return opcode; kOpComment if cmd is empty, kOpInvalid if unrecognized
+ */
+inline TraceOpcode OpcodeFromName(std::string_view cmd) {
+  if (cmd.empty()) {
+    return kOpComment;
+  }
+  // The first character (with the length for 'c') selects the only
+  // possible command, so at most one full comparison is needed
+  TraceOpcode op;
+  switch (cmd[0]) {
+    case 'q': op = kOpQuota; break;
+    case 'c': op = cmd.size() == 4 ? kOpCopy : kOpCompare; break;
+    case 'p': op = kOpPut; break;
+    case 'f': op = kOpFill; break;
+    case 'd': op = kOpDump; break;
+    case 'w': op = kOpWritable; break;
+    default: return kOpInvalid;
+  }
+  return cmd == OpcodeName(op) ? op : kOpInvalid;
+}
+
+/**
+ * EncodeVarint - encode a 32 bit value as a varint
+ *
+ * @param value value to encode
+ * @param out buffer of at least kMaxVarintSize bytes
+ * @return number of bytes written to out
+ */
+inline size_t EncodeVarint(uint32_t value, uint8_t *out) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = static_cast<uint8_t>(value);
+  return n;
+}
+
+/**
+ * DecodeVarint - decode a varint from a buffer
+ *
+ * @param in start of encoded value
+ * @param end end of available input
+ * @param value returns decoded value
+ * @return pointer to first byte after the varint, or nullptr if the input
+ *   is truncated or the varint is longer than kMaxVarintSize
+ */
+inline const uint8_t *DecodeVarint(const uint8_t *in, const uint8_t *end,
+                                   uint32_t &value) {
+  uint32_t result = 0;
+  for (unsigned shift = 0; shift < 7 * kMaxVarintSize && in < end; shift += 7) {
+    uint8_t b = *in++;
+    result |= static_cast<uint32_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      value = result;
+      return in;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * SkipRecord - find the end of a binary trace record
+ *
+ * @param in start of record
+ * @param end end of available input
+ * @return pointer to first byte after the record, or nullptr if the record
+ *   is malformed or truncated
+ */
+inline const uint8_t *SkipRecord(const uint8_t *in, const uint8_t *end) {
+  if (in == end || *in >= kOpCount) {
+    return nullptr;
+  }
+  TraceOpcode op = static_cast<TraceOpcode>(*in++);
+
+  // Line text, then operands: number of varints, then raw bytes
+  uint32_t value;
+  if ((in = DecodeVarint(in, end, value)) == nullptr
+      || static_cast<size_t>(end - in) < value) {
+    return nullptr;
+  }
+  in += value;
+  static const int kVarints[kOpCount] = { 0, 1, 2, 2, 2, 3, 2, 3, 0 };
+  for (int i = 0; i < kVarints[op]; ++i) {
+    if ((in = DecodeVarint(in, end, value)) == nullptr) {
+      return nullptr;
+    }
+  }
+  size_t raw = op == kOpCompare || op == kOpPut ? value : op == kOpFill ? 1 : 0;
+  if (static_cast<size_t>(end - in) < raw) {
+    return nullptr;
+  }
+  return in + raw;
+}
+
+/**
+ * CountTraceLines - count the lines of a text or binary trace, which is the
+ *   number of lines a process executing the trace runs
+ *
+ * @param begin start of trace file contents
+ * @param end end of trace file contents
+ * @return number of lines (for a binary trace, the number of well formed
+ *   records before any error)
+ */
+inline long CountTraceLines(const char *begin, const char *end) {
+  const uint8_t *in = reinterpret_cast<const uint8_t*>(begin);
+  const uint8_t *in_end = reinterpret_cast<const uint8_t*>(end);
+  long lines = 0;
+  if (static_cast<size_t>(end - begin) >= kBinaryTraceMagicSize
+      && std::equal(in, in + kBinaryTraceMagicSize, kBinaryTraceMagic)) {
+    in += kBinaryTraceMagicSize;
+    while (in != in_end && (in = SkipRecord(in, in_end)) != nullptr) {
+      ++lines;
+    }
+    return lines;
+  }
+
+  // Text: every line ends with a newline, except perhaps the last
+  lines = std::count(begin, end, '\n');
+  if (begin != end && end[-1] != '\n') {
+    ++lines;
+  }
+  return lines;
+}
+
+}  // namespace trace_format
+
+#endif /* TRACEFORMAT_H */
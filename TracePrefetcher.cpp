@@ -0,0 +1,117 @@
+/*
+ * TracePrefetcher implementation
+ */
+
+/*
+ * File:   TracePrefetcher.cpp
+ */
+
+#include "TracePrefetcher.h"
+
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+TracePrefetcher::TracePrefetcher(size_t depth_, size_t budget_)
+: depth(depth_), budget(budget_), window(depth_), next_stream(0),
+  stopping(false), bytes_prefetched(0) {
+  reader = std::thread(&TracePrefetcher::Run, this);
+}
+
+TracePrefetcher::~TracePrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  reader.join();
+}
+
+TracePrefetcher::Stream *TracePrefetcher::Add(
+    std::shared_ptr<TraceFile> trace) {
+  std::shared_ptr<Stream> stream(new Stream);
+  stream->trace = trace;
+  stream->offset = 0;
+  stream->prefetched = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    streams.push_back(stream);
+    UpdateWindow();
+  }
+  wake.notify_one();
+  return stream.get();
+}
+
+void TracePrefetcher::Remove(Stream *stream) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto found = std::find_if(streams.begin(), streams.end(),
+                            [stream](const std::shared_ptr<Stream> &s) {
+                              return s.get() == stream;
+                            });
+  if (found != streams.end()) {
+    streams.erase(found);
+    UpdateWindow();
+  }
+}
+
+size_t TracePrefetcher::Advance(Stream *stream, size_t offset) {
+  stream->offset.store(offset, std::memory_order_relaxed);
+  size_t current = window.load(std::memory_order_relaxed);
+  size_t wanted = std::min(stream->trace->get_size(), offset + current / 2);
+  if (stream->prefetched.load(std::memory_order_relaxed) < wanted) {
+    std::lock_guard<std::mutex> lock(mutex);
+    wake.notify_one();
+  }
+  return offset + current / 4;
+}
+
+void TracePrefetcher::UpdateWindow(void) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t share = streams.empty() ? budget : budget / streams.size();
+  window = std::max(page_size, std::min(depth, share));
+}
+
+void TracePrefetcher::Run(void) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    // Find a stream whose prefetched bytes don't reach its window
+    std::shared_ptr<Stream> stream;
+    size_t begin = 0, end = 0;
+    for (size_t n = 0; n < streams.size(); ++n) {
+      if (next_stream >= streams.size()) {
+        next_stream = 0;
+      }
+      Stream &s = *streams[next_stream++];
+      size_t target = std::min(s.trace->get_size(),
+                               s.offset.load(std::memory_order_relaxed)
+                               + window.load(std::memory_order_relaxed));
+      size_t prefetched = s.prefetched.load(std::memory_order_relaxed);
+      if (prefetched < target) {
+        stream = streams[next_stream - 1];
+        begin = prefetched;
+        end = std::min(target, begin + kChunkSize);
+        break;
+      }
+    }
+    if (!stream) {
+      wake.wait(lock);
+      continue;
+    }
+
+    // Fault in the pages of the chunk without holding the lock. The mapping
+    // stays valid since the stream holds the trace.
+    lock.unlock();
+    const char *data = stream->trace->begin();
+    size_t first = begin / page_size * page_size;
+    madvise(const_cast<char*>(data + first), end - first, MADV_WILLNEED);
+    volatile char sink = 0;
+    for (size_t offset = first; offset < end; offset += page_size) {
+      sink += data[offset];
+    }
+    stream->prefetched.store(end, std::memory_order_relaxed);
+    bytes_prefetched.fetch_add(end - begin, std::memory_order_relaxed);
+    lock.lock();
+  }
+}
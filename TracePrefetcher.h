@@ -0,0 +1,130 @@
+/*
+ * TracePrefetcher - reads trace files ahead of the processes executing them,
+ * so that execution doesn't stall on file I/O.
+ *
+ * Traces are memory mapped (see TraceFile), so a process reading the next
+ * line of a trace that isn't in the page cache blocks in a page fault, which
+ * on slow or network storage can take far longer than executing the line.
+ * The prefetcher runs a reader thread which faults in the pages of each
+ * trace up to a window past the point its process has reached, so the
+ * process finds them resident. Parsing still happens during execution: it
+ * is cheap once the bytes are in memory, and depends on nothing but the
+ * trace.
+ *
+ * Each trace read is a Stream. The process is the only writer of its
+ * stream's read offset and the reader thread the only writer of how far it
+ * has prefetched, so the two exchange positions through atomics without
+ * locking; the process takes the lock only to wake the reader when its
+ * window runs low. The window of each stream is the prefetch depth, reduced
+ * so the windows of all streams fit in the memory budget (but never below
+ * one page).
+ */
+
+/*
+ * File:   TracePrefetcher.h
+ */
+
+#ifndef TRACEPREFETCHER_H
+#define TRACEPREFETCHER_H
+
+#include "TraceFile.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TracePrefetcher {
+public:
+  /**
+   * Stream - prefetch state of one trace being read
+   */
+  struct Stream {
+    std::shared_ptr<TraceFile> trace;
+    std::atomic<size_t> offset;      // read position of the process
+    std::atomic<size_t> prefetched;  // end of bytes faulted in
+  };
+
+  /**
+   * Constructor - start the reader thread
+   *
+   * @param depth_ bytes to read ahead of each process
+   * @param budget_ most bytes read ahead over all processes
+   */
+  TracePrefetcher(size_t depth_, size_t budget_);
+
+  /**
+   * Destructor - stop the reader thread
+   */
+  virtual ~TracePrefetcher();
+
+  // Disallow copy/move
+  TracePrefetcher(const TracePrefetcher &other) = delete;
+  TracePrefetcher(TracePrefetcher &&other) = delete;
+  TracePrefetcher &operator=(const TracePrefetcher &other) = delete;
+  TracePrefetcher &operator=(TracePrefetcher &&other) = delete;
+
+  /**
+   * Add - start prefetching a trace from its beginning
+   *
+   * @param trace mapped trace file
+   * @return stream to pass to Advance and Remove
+   */
+  Stream *Add(std::shared_ptr<TraceFile> trace);
+
+  /**
+   * Remove - stop prefetching a stream (it must not be used again)
+   */
+  void Remove(Stream *stream);
+
+  /**
+   * Advance - report how far a process has read its trace, waking the
+   *   reader thread if less than half the window is left prefetched
+   *
+   * @param stream stream of the trace
+   * @param offset offset of the next byte the process will read
+   * @return offset at which to report again
+   */
+  size_t Advance(Stream *stream, size_t offset);
+
+  /**
+   * get_bytes_prefetched - bytes of trace faulted in by the reader thread
+   */
+  uint64_t get_bytes_prefetched(void) const { return bytes_prefetched; }
+
+private:
+  size_t depth;
+  size_t budget;
+  std::atomic<size_t> window;  // current window of each stream
+
+  // Streams being prefetched, and next one the reader looks at, guarded
+  // by mutex; the reader holds a reference to the stream it is reading
+  std::vector<std::shared_ptr<Stream>> streams;
+  size_t next_stream;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<uint64_t> bytes_prefetched;
+  std::thread reader;
+
+  // Most bytes read for one stream before looking at the others
+  static const size_t kChunkSize = 0x40000;
+
+  /**
+   * UpdateWindow - set the window for the current number of streams.
+   *   Call with mutex held.
+   */
+  void UpdateWindow(void);
+
+  /**
+   * Run - body of the reader thread: fault in the next chunk of whichever
+   *   stream is short of its window, round robin, or wait to be woken
+   */
+  void Run(void);
+};
+
+#endif /* TRACEPREFETCHER_H */
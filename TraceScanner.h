@@ -0,0 +1,218 @@
+/*
+ * TraceScanner - low level scanning of text trace lines.
+ *
+ * These functions scan tokens and hexadecimal numbers directly out of a
+ * character buffer (normally the memory mapped trace file), without building
+ * strings or stream objects. They accept the same input as extracting with
+ * "stream >> std::hex >> value" in the "C" locale: leading white space is
+ * skipped, an optional sign and "0x" prefix are accepted, and a value that
+ * doesn't fit in 32 bits fails the scan. Shared by ProcessTrace and
+ * TraceCompiler so both interpret text traces identically.
+ *
+ * ScanHexBytes is a fast path for the long lists of byte values of put and
+ * compare lines: with SSE2 (or NEON) it classifies 16 characters at a time
+ * as hex digits or white space, and takes every value of one or two digits
+ * in the block at once. Anything else (prefixes, signs, longer numbers,
+ * invalid characters) is left to ScanHex.
+ */
+
+/*
+ * File:   TraceScanner.h
+ */
+
+#ifndef TRACESCANNER_H
+#define TRACESCANNER_H
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace trace_format {
+
+/**
+ * IsSpace - true if c is white space in the "C" locale
+ */
+inline bool IsSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * HexDigitValue - value of a hexadecimal digit
+ *
+ * @return 0-15, or -1 if c is not a hex digit
+ */
+inline int HexDigitValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c |= 0x20;  // fold to lower case
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+/**
+ * SkipSpace - skip white space
+ *
+ * @return pointer to first non-space character, or end
+ */
+inline const char *SkipSpace(const char *p, const char *end) {
+  while (p < end && IsSpace(*p)) ++p;
+  return p;
+}
+
+/**
+ * ScanToken - find end of the token (non-space characters) starting at p
+ *
+ * @return pointer to first white space character after p, or end
+ */
+inline const char *ScanToken(const char *p, const char *end) {
+  while (p < end && !IsSpace(*p)) ++p;
+  return p;
+}
+
+/**
+ * ScanHex - scan a hexadecimal number, skipping leading white space
+ *
+ * @param p start of input
+ * @param end end of input
+ * @param value returns value scanned
+ * @return pointer to first character after the number, or nullptr if there
+ *   is no number at p or it overflows 32 bits
+ */
+inline const char *ScanHex(const char *p, const char *end, uint32_t &value) {
+  p = SkipSpace(p, end);
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  if (end - p >= 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+    p += 2;  // a prefix must be followed by at least one digit
+  }
+
+  const char *digits = p;
+  uint64_t result = 0;
+  int digit;
+  while (p < end && (digit = HexDigitValue(*p)) >= 0) {
+    result = (result << 4) | digit;
+    if (result > 0xFFFFFFFFu) {
+      return nullptr;
+    }
+    ++p;
+  }
+  if (p == digits) {
+    return nullptr;
+  }
+
+  value = negative ? 0u - static_cast<uint32_t>(result)
+                   : static_cast<uint32_t>(result);
+  return p;
+}
+
+#if defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+/**
+ * ClassifyBlock - classify 16 characters
+ *
+ * @param p first character
+ * @param hex returns mask with bit i set if p[i] is a hex digit
+ * @param space returns mask with bit i set if p[i] is white space
+ */
+inline void ClassifyBlock(const char *p, uint32_t &hex, uint32_t &space) {
+#if defined(__SSE2__)
+  // x <= k as unsigned bytes
+  auto at_most = [](__m128i x, char k) {
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(k)), x);
+  };
+  __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+  __m128i is_hex = _mm_or_si128(
+      at_most(_mm_sub_epi8(c, _mm_set1_epi8('0')), 9),
+      at_most(_mm_sub_epi8(lower, _mm_set1_epi8('a')), 5));
+  __m128i is_space = _mm_or_si128(
+      _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+      at_most(_mm_sub_epi8(c, _mm_set1_epi8('\t')), '\r' - '\t'));
+  hex = _mm_movemask_epi8(is_hex);
+  space = _mm_movemask_epi8(is_space);
+#else
+  // NEON has no movemask: weight each byte by its bit and add across halves
+  static const uint8_t kBits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                    1, 2, 4, 8, 16, 32, 64, 128};
+  auto mask = [](uint8x16_t x) {
+    uint8x16_t bits = vandq_u8(x, vld1q_u8(kBits));
+    return static_cast<uint32_t>(vaddv_u8(vget_low_u8(bits)))
+        | static_cast<uint32_t>(vaddv_u8(vget_high_u8(bits))) << 8;
+  };
+  uint8x16_t c = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+  uint8x16_t lower = vorrq_u8(c, vdupq_n_u8(0x20));
+  hex = mask(vorrq_u8(vcleq_u8(vsubq_u8(c, vdupq_n_u8('0')), vdupq_n_u8(9)),
+                      vcleq_u8(vsubq_u8(lower, vdupq_n_u8('a')),
+                               vdupq_n_u8(5))));
+  space = mask(vorrq_u8(vceqq_u8(c, vdupq_n_u8(' ')),
+                        vcleq_u8(vsubq_u8(c, vdupq_n_u8('\t')),
+                                 vdupq_n_u8('\r' - '\t'))));
+#endif
+}
+#endif
+
+/**
+ * ScanHexBytes - scan a list of hexadecimal byte values as repeated calls of
+ *   ScanHex would, appending each value to bytes. Stops where the fast path
+ *   can't continue, always at or before a value that doesn't fit in a byte;
+ *   scanning then continues with ScanHex. Without vector support it scans
+ *   nothing.
+ *
+ * @param p start of input; must not follow a hex digit
+ * @param end end of input
+ * @param bytes values scanned are appended
+ * @return pointer to where scanning stopped: after the last value scanned,
+ *   or at white space or the start of a value not scanned
+ */
+inline const char *ScanHexBytes(const char *p, const char *end,
+                                std::vector<uint8_t> &bytes) {
+#if defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+  // The digits of a hex digit c have value (c & 0xf), plus 9 for letters
+  auto digit = [](char c) { return (c & 0xF) + ((c >> 6) & 1) * 9; };
+  while (end - p >= 16) {
+    uint32_t hex, space;
+    ClassifyBlock(p, hex, space);
+    if ((hex | space) != 0xFFFF) {
+      return p;
+    }
+
+    // Take each number ending inside the block; one running past its end
+    // is scanned from its first digit in the next block
+    const char *next = p + 16;
+    for (uint32_t starts = hex & ~(hex << 1); starts != 0;
+         starts &= starts - 1) {
+      int start = __builtin_ctz(starts);
+      uint32_t after = ~hex & (0xFFFFu << start) & 0xFFFF;
+      if (after == 0) {
+        next = p + start;
+        break;
+      }
+      int length = __builtin_ctz(after) - start;
+      if (length > 2) {
+        return p + start;  // may not fit in a byte
+      }
+      int value = digit(p[start]);
+      if (length == 2) {
+        value = value << 4 | digit(p[start + 1]);
+      }
+      bytes.push_back(static_cast<uint8_t>(value));
+    }
+    if (next == p) {
+      return p;  // number longer than a block
+    }
+    p = next;
+  }
+#endif
+  return p;
+}
+
+}  // namespace trace_format
+
+#endif /* TRACESCANNER_H */
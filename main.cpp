@@ -20,48 +20,232 @@
  * 
  * The process number is the position of the trace file name in the list, where the first process is 1,
  * the second 2, etc/
+ * 
+ * Options may precede the time slice; see Usage below.
+ * 
+ * Alternatively, "--compile text_trace binary_trace" converts a text trace file to the
+ * binary trace format (see TraceFormat.h), which may then be given in place of the text file.
  */
 
+#include "OutputSink.h"
 #include "PageFrameAllocator.h"
+#include "PageReplacer.h"
 #include "ProcessTrace.h"
 #include "Scheduler.h"
+#include "SchedulingPolicy.h"
+#include "TraceCompiler.h"
 
 #include <MMU.h>
 
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+// Page frames of simulated physical memory: 4 MiB by default, and at most
+// 4 GiB, the range of 32-bit physical addresses
+const long kDefaultFrames = 1024;
+const long kMaxFrames = 0x100000;
+
+/*
+ * Usage - print command line usage and exit
+ */
+void Usage(const char *program) {
+  std::cerr << "usage: " << program << " [options] time_slice trace_file...\n"
+            << "       " << program << " --compile text_trace binary_trace\n"
+            << "options:\n"
+            << "  --output file     write output to file instead of standard output\n"
+            << "  --frames n        page frames of simulated physical memory (4 KiB\n"
+            << "                    each; default 1024, at most 1048576 = 4 GiB)\n"
+            << "  --threads n       run processes on n worker threads\n"
+            << "  --unordered       with --threads, write output of each time slice as it\n"
+            << "                    completes rather than in scheduling order\n"
+            << "  --policy name     scheduling policy: rr (round-robin, default), srl\n"
+            << "                    (shortest remaining lines), fault (rate limit\n"
+            << "                    processes allocating many pages), adaptive (longer\n"
+            << "                    slices for processes not allocating pages)\n"
+            << "  --dedup           share page frames of identical pages between\n"
+            << "                    processes, copying them when written\n"
+            << "  --huge-pages      map a 4 MiB region (one L2 page table) in one pass,\n"
+            << "                    to adjacent frames, when a write covers all of it\n"
+            << "  --swap file       when page frames run out, evict pages to swap file\n"
+            << "                    (replaced if it exists, and removed once open)\n"
+            << "  --replacement name\n"
+            << "                    page replacement policy with --swap: clock\n"
+            << "                    (second chance, default) or aging (LRU\n"
+            << "                    approximation)\n"
+            << "  --prefetch bytes  read each trace up to bytes ahead of its process on\n"
+            << "                    a reader thread, so execution doesn't wait for\n"
+            << "                    the file (default 0, no prefetching)\n"
+            << "  --prefetch-budget bytes\n"
+            << "                    most bytes read ahead over all traces (default\n"
+            << "                    67108864 = 64 MiB)\n"
+            << "  --max-mapped-traces n\n"
+            << "                    keep at most n traces mapped between time slices,\n"
+            << "                    mapping the others again when they run (default 0,\n"
+            << "                    no limit; not with --prefetch)\n"
+            << "  --checkpoint file write the state of the simulation to file once lines\n"
+            << "                    (over all processes) have executed, and go on\n"
+            << "  --checkpoint-at lines\n"
+            << "                    lines to execute before the checkpoint (default 0)\n"
+            << "  --restore file    resume from a checkpoint written with the same trace\n"
+            << "                    files, time slice, policy and --frames\n"
+            << "                    (checkpoints need a single thread, no --dedup and\n"
+            << "                    no --swap)\n"
+            << "  --stats format    write performance counters to standard error at\n"
+            << "                    exit, as a table or json\n"
+            << "  --trace-events file\n"
+            << "                    write the time slices run to file at exit, as Chrome\n"
+            << "                    trace event JSON\n";
+  exit(1);
+}
+}
+
 /*
  * 
  */
 int main(int argc, char* argv[]) {
-  // Use command line argument as file name
-  /*
-    if (argc != 2) {
-    std::cerr << "usage: Lab2 trace_file\n";
-    exit(1);
+  // Compile a text trace to binary format
+  if (argc == 4 && std::string(argv[1]) == "--compile") {
+    TraceCompiler compiler(argv[2], argv[3]);
+    return compiler.Compile() ? 0 : 2;
+  }
+  
+  // Options precede the time slice
+  int output_fd = STDOUT_FILENO;
+  SchedulerOptions options;
+  std::string stats_format;
+  std::string trace_events_file;
+  long frames = kDefaultFrames;
+  int arg = 1;
+  while (arg < argc && std::string(argv[arg]).compare(0, 2, "--") == 0) {
+    std::string option = argv[arg++];
+    if (option == "--output" && arg < argc) {
+      output_fd = open(argv[arg], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (output_fd < 0) {
+        std::cerr << "ERROR: failed to create output file: " << argv[arg] << "\n";
+        exit(2);
+      }
+      ++arg;
+    } else if (option == "--frames" && arg < argc) {
+      frames = std::atol(argv[arg++]);
+      if (frames < 1 || frames > kMaxFrames) {
+        Usage(argv[0]);
+      }
+    } else if (option == "--threads" && arg < argc) {
+      options.threads = std::atoi(argv[arg++]);
+      if (options.threads < 1) {
+        Usage(argv[0]);
+      }
+    } else if (option == "--unordered") {
+      options.ordered = false;
+    } else if (option == "--dedup") {
+      options.dedup = true;
+    } else if (option == "--huge-pages") {
+      options.huge_pages = true;
+    } else if (option == "--swap" && arg < argc) {
+      options.swap_file = argv[arg++];
+    } else if (option == "--replacement" && arg < argc) {
+      options.replacement = argv[arg++];
+      PageReplacer::Policy replacement;
+      if (!PageReplacer::PolicyFromName(options.replacement, replacement)) {
+        Usage(argv[0]);
+      }
+    } else if (option == "--prefetch" && arg < argc) {
+      long depth = std::atol(argv[arg++]);
+      if (depth < 0) {
+        Usage(argv[0]);
+      }
+      options.prefetch_depth = depth;
+    } else if (option == "--prefetch-budget" && arg < argc) {
+      long budget = std::atol(argv[arg++]);
+      if (budget < 1) {
+        Usage(argv[0]);
+      }
+      options.prefetch_budget = budget;
+    } else if (option == "--max-mapped-traces" && arg < argc) {
+      long traces = std::atol(argv[arg++]);
+      if (traces < 0) {
+        Usage(argv[0]);
+      }
+      options.max_mapped_traces = traces;
+    } else if (option == "--checkpoint" && arg < argc) {
+      options.checkpoint_file = argv[arg++];
+    } else if (option == "--checkpoint-at" && arg < argc) {
+      long long lines = std::atoll(argv[arg++]);
+      if (lines < 0) {
+        Usage(argv[0]);
+      }
+      options.checkpoint_at = lines;
+    } else if (option == "--restore" && arg < argc) {
+      options.restore_file = argv[arg++];
+    } else if (option == "--stats" && arg < argc) {
+      stats_format = argv[arg++];
+      if (stats_format != "table" && stats_format != "json") {
+        Usage(argv[0]);
+      }
+      options.timing = true;
+    } else if (option == "--trace-events" && arg < argc) {
+      trace_events_file = argv[arg++];
+      options.trace_events = true;
+    } else if (option == "--policy" && arg < argc) {
+      options.policy = argv[arg++];
+      if (!SchedulingPolicy::Create(options.policy, 1)) {
+        Usage(argv[0]);
+      }
+    } else {
+      Usage(argv[0]);
+    }
+  }
+  if (arg >= argc) {
+    Usage(argv[0]);
+  }
+  if ((!options.checkpoint_file.empty() || !options.restore_file.empty())
+      && (options.threads > 1 || options.dedup || !options.swap_file.empty())) {
+    Usage(argv[0]);
+  }
+  if (options.max_mapped_traces > 0 && options.prefetch_depth > 0) {
+    Usage(argv[0]);
   }
-   * */
-    
   
   //create an instance of the MMU with 1024 page frames
-  //(4MB of simulated physical memory)
-  mem::MMU memory(1024); 
+  //(4MB of simulated physical memory) unless --frames is given
+  mem::MMU memory(frames);
   
   //each process (instance of Execute Trace) will need to have
   //its own set of page frames allocated.
   PageFrameAllocator allocator(memory);
   std::vector<std::string> file_names;
-  int time_slice = std::stoi(argv[1]);
-  for(int i = 2; i < argc; ++i){
+  int time_slice = std::stoi(argv[arg]);
+  for(int i = arg + 1; i < argc; ++i){
       file_names.push_back(argv[i]);
   }
   
+  //all output is buffered and written at time slice boundaries
+  OutputSink output(output_fd);
+  
   //Execute the processes
-  Scheduler scheduler(file_names, memory, allocator, time_slice);
+  Scheduler scheduler(file_names, memory, allocator, output, time_slice,
+                      options);
   scheduler.Execute();
+  if (!stats_format.empty()) {
+    scheduler.WriteStats(std::cerr, stats_format == "json");
+  }
+  if (!trace_events_file.empty()) {
+    std::ofstream trace_events(trace_events_file);
+    scheduler.WriteTraceEvents(trace_events);
+    trace_events.close();
+    if (!trace_events) {
+      std::cerr << "ERROR: failed to write trace event file: "
+                << trace_events_file << "\n";
+      exit(2);
+    }
+  }
   
   return 0;
 }
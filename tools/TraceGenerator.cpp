@@ -0,0 +1,308 @@
+/*
+ * TraceGenerator implementation
+ */
+
+/*
+ * File:   TraceGenerator.cpp
+ */
+
+#include "TraceGenerator.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using std::cerr;
+using std::ostream;
+
+namespace {
+const uint32_t kPageSize = 0x1000;
+
+// Largest put, compare and dump
+const uint32_t kMaxPutBytes = 16;
+const uint32_t kMaxCompareBytes = 16;
+const uint32_t kMaxDumpBytes = 0x40;
+}
+
+TraceGenerator::TraceGenerator(const Options &options_)
+: options(options_), random(options_.seed) {
+  // The copy source and destination are the two halves of the working set,
+  // so it has at least two pages
+  uint32_t page_count = std::max<uint32_t>(
+          2, (options.working_set + kPageSize - 1) / kPageSize);
+  options.working_set = page_count * kPageSize;
+  memory.resize(options.working_set, 0);
+  writable.resize(page_count, true);
+}
+
+bool TraceGenerator::Preset(const std::string &name, Options &options) {
+  Options defaults;
+  options.fill_weight = defaults.fill_weight;
+  options.copy_weight = defaults.copy_weight;
+  options.put_weight = defaults.put_weight;
+  options.sparse_weight = defaults.sparse_weight;
+  options.compare_weight = defaults.compare_weight;
+  options.dump_weight = defaults.dump_weight;
+  options.writable_weight = defaults.writable_weight;
+  options.quota_weight = defaults.quota_weight;
+  if (name == "mixed") {
+    return true;
+  } else if (name == "fill") {
+    options.fill_weight = 8;
+    options.copy_weight = options.put_weight = options.compare_weight = 0;
+    options.dump_weight = options.writable_weight = 0;
+  } else if (name == "copy") {
+    options.copy_weight = 8;
+    options.fill_weight = options.put_weight = 0;
+    options.dump_weight = options.writable_weight = 0;
+  } else if (name == "sparse") {
+    options.sparse_weight = 2;
+    options.fill_weight = options.copy_weight = 0;
+    options.writable_weight = 0;
+  } else if (name == "quota") {
+    options.quota_weight = 1;
+    options.sparse_weight = 1;
+  } else if (name == "writable") {
+    options.writable_weight = 4;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char TraceGenerator::kOptionsUsage[] =
+  "workload options (sizes and addresses in hexadecimal):\n"
+  "  --workload name      mixed (default), fill, copy, sparse, quota, writable\n"
+  "  --seed n             random seed\n"
+  "  --lines n            commands per trace (decimal)\n"
+  "  --quota pages        initial page quota\n"
+  "  --base addr          start of working set\n"
+  "  --working-set size   size of working set\n"
+  "  --fill-size size     largest fill\n"
+  "  --copy-size size     largest copy\n"
+  "  --sparse-burst n     puts in a sparse put storm (decimal)\n"
+  "  --KIND-weight n      relative frequency of fill, copy, put, sparse,\n"
+  "                       compare, dump, writable or quota (decimal)\n";
+
+bool TraceGenerator::ParseOption(const std::string &option,
+                                 const std::string &value, Options &options) {
+  if (option == "--workload") {
+    return Preset(value, options);
+  }
+  size_t end = 0;
+  unsigned long number;
+  bool hex = option == "--quota" || option == "--base"
+             || option == "--working-set" || option == "--fill-size"
+             || option == "--copy-size";
+  try {
+    number = std::stoul(value, &end, hex ? 16 : 10);
+  } catch (const std::logic_error &e) {
+    return false;
+  }
+  if (end != value.size() || number > 0xFFFFFFFF) {
+    return false;
+  }
+
+  struct Weight {
+    const char *option;
+    int Options::*weight;
+  };
+  static const Weight kWeights[] = {
+    {"--fill-weight", &Options::fill_weight},
+    {"--copy-weight", &Options::copy_weight},
+    {"--put-weight", &Options::put_weight},
+    {"--sparse-weight", &Options::sparse_weight},
+    {"--compare-weight", &Options::compare_weight},
+    {"--dump-weight", &Options::dump_weight},
+    {"--writable-weight", &Options::writable_weight},
+    {"--quota-weight", &Options::quota_weight}
+  };
+  for (const Weight &w : kWeights) {
+    if (option == w.option) {
+      options.*w.weight = std::min<unsigned long>(number, 1000000);
+      return true;
+    }
+  }
+
+  if (option == "--seed") {
+    options.seed = number;
+  } else if (option == "--lines") {
+    options.lines = number;
+  } else if (option == "--quota") {
+    options.quota = number;
+  } else if (option == "--base") {
+    options.base = number;
+  } else if (option == "--working-set" && number > 0
+             && number <= 0x100000000ul - options.base) {
+    options.working_set = number;
+  } else if (option == "--fill-size" && number > 0) {
+    options.fill_size = number;
+  } else if (option == "--copy-size" && number > 0) {
+    options.copy_size = number;
+  } else if (option == "--sparse-burst") {
+    options.sparse_burst = number;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void TraceGenerator::Write(ostream &out) {
+  std::ios_base::fmtflags flags = out.flags();
+  out << std::hex;
+
+  // Prologue: quota, and make the whole working set present
+  out << "quota " << options.quota << "\n"
+      << "fill " << options.base << " " << options.working_set << " 0\n";
+  for (uint32_t page = 0; page < writable.size(); ++page) {
+    pages.insert((options.base >> 12) + page);
+  }
+
+  typedef void (TraceGenerator::*Writer)(ostream &out);
+  const Writer writers[] = {
+    &TraceGenerator::WriteFill, &TraceGenerator::WriteCopy,
+    &TraceGenerator::WritePut, &TraceGenerator::WriteSparse,
+    &TraceGenerator::WriteCompare, &TraceGenerator::WriteDump,
+    &TraceGenerator::WriteWritable, &TraceGenerator::WriteQuota
+  };
+  const int weights[] = {
+    options.fill_weight, options.copy_weight, options.put_weight,
+    options.sparse_weight, options.compare_weight, options.dump_weight,
+    options.writable_weight, options.quota_weight
+  };
+  const int kinds = sizeof(weights) / sizeof(weights[0]);
+  uint32_t total_weight = 0;
+  for (int kind = 0; kind < kinds; ++kind) {
+    total_weight += std::max(0, weights[kind]);
+  }
+
+  for (long line = 0; total_weight > 0 && line < options.lines; ++line) {
+    uint32_t pick = Random(total_weight);
+    int kind = 0;
+    while (pick >= static_cast<uint32_t>(std::max(0, weights[kind]))) {
+      pick -= std::max(0, weights[kind]);
+      ++kind;
+    }
+    (this->*writers[kind])(out);
+  }
+  out.flags(flags);
+}
+
+bool TraceGenerator::WriteFile(const std::string &file_name) {
+  std::ofstream out(file_name, std::ios_base::out | std::ios_base::trunc);
+  if (!out.is_open()) {
+    cerr << "ERROR: failed to create trace file: " << file_name << "\n";
+    return false;
+  }
+  Write(out);
+  out.close();
+  if (out.fail()) {
+    cerr << "ERROR: failed to write trace file: " << file_name << "\n";
+    return false;
+  }
+  return true;
+}
+
+uint32_t TraceGenerator::Random(uint32_t n) {
+  // Reduce the raw generator output ourselves; the standard distributions
+  // differ between library implementations
+  return n == 0 ? 0 : random() % n;
+}
+
+void TraceGenerator::Store(uint32_t addr, const uint8_t *bytes,
+                           uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t offset = addr + i - options.base;
+    if (addr + i < options.base || offset >= options.working_set) {
+      continue;
+    }
+    if (!writable[offset / kPageSize]) {
+      return;
+    }
+    memory[offset] = bytes[i];
+  }
+}
+
+void TraceGenerator::WriteFill(ostream &out) {
+  uint32_t offset = Random(options.working_set);
+  uint32_t count = 1 + Random(std::min(options.fill_size,
+                                       options.working_set - offset));
+  uint8_t value = Random(256);
+  out << "fill " << options.base + offset << " " << count << " "
+      << static_cast<uint32_t>(value) << "\n";
+  std::vector<uint8_t> bytes(count, value);
+  Store(options.base + offset, bytes.data(), count);
+}
+
+void TraceGenerator::WriteCopy(ostream &out) {
+  uint32_t half = options.working_set / 2;
+  uint32_t count = 1 + Random(std::min(options.copy_size, half));
+  uint32_t src = Random(half - count + 1);
+  uint32_t dest = half + Random(half - count + 1);
+  out << "copy " << options.base + dest << " " << options.base + src << " "
+      << count << "\n";
+  std::vector<uint8_t> bytes(memory.begin() + src,
+                             memory.begin() + src + count);
+  Store(options.base + dest, bytes.data(), count);
+}
+
+void TraceGenerator::WritePut(ostream &out) {
+  uint32_t count = 1 + Random(kMaxPutBytes);
+  uint32_t offset = Random(options.working_set - count + 1);
+  std::vector<uint8_t> bytes(count);
+  out << "put " << options.base + offset;
+  for (uint8_t &b : bytes) {
+    b = Random(256);
+    out << " " << static_cast<uint32_t>(b);
+  }
+  out << "\n";
+  Store(options.base + offset, bytes.data(), count);
+}
+
+void TraceGenerator::WriteSparse(ostream &out) {
+  for (uint32_t put = 0; put < options.sparse_burst; ++put) {
+    uint32_t count = 1 + Random(4);
+    uint32_t addr = (Random(0x10000) << 16) | Random(0x10000);
+    addr = std::min<uint32_t>(addr, 0xFFFFFFFF - count + 1);
+    std::vector<uint8_t> bytes(count);
+    out << "put " << addr;
+    for (uint8_t &b : bytes) {
+      b = Random(256);
+      out << " " << static_cast<uint32_t>(b);
+    }
+    out << "\n";
+    pages.insert(addr >> 12);
+    pages.insert((addr + count - 1) >> 12);
+    Store(addr, bytes.data(), count);
+  }
+}
+
+void TraceGenerator::WriteCompare(ostream &out) {
+  uint32_t count = 1 + Random(kMaxCompareBytes);
+  uint32_t offset = Random(options.working_set - count + 1);
+  out << "compare " << options.base + offset;
+  for (uint32_t i = 0; i < count; ++i) {
+    out << " " << static_cast<uint32_t>(memory[offset + i]);
+  }
+  out << "\n";
+}
+
+void TraceGenerator::WriteDump(ostream &out) {
+  uint32_t count = 1 + Random(kMaxDumpBytes);
+  uint32_t offset = Random(options.working_set - count + 1);
+  out << "dump " << options.base + offset << " " << count << "\n";
+}
+
+void TraceGenerator::WriteWritable(ostream &out) {
+  uint32_t page = Random(writable.size());
+  uint32_t count = 1 + Random(std::min<uint32_t>(4, writable.size() - page));
+  bool status = Random(2) != 0;
+  out << "writable " << options.base + page * kPageSize << " "
+      << count * kPageSize << " " << status << "\n";
+  std::fill(writable.begin() + page, writable.begin() + page + count, status);
+}
+
+void TraceGenerator::WriteQuota(ostream &out) {
+  out << "quota " << pages.size() + Random(4) << "\n";
+}
@@ -0,0 +1,157 @@
+/*
+ * TraceGenerator - write synthetic text memory traces (see ProcessTrace.h)
+ * for benchmarking.
+ *
+ * A trace starts with a quota and a fill of the whole working set (so every
+ * working set page is present), followed by commands chosen at random in
+ * proportion to their weights in Options:
+ *   fill      fill of up to fill_size bytes in the working set
+ *   copy      copy of up to copy_size bytes from the lower to the upper half
+ *             of the working set
+ *   put       put of up to 16 bytes in the working set
+ *   sparse    a storm of sparse_burst one to four byte puts at random
+ *             addresses anywhere in the 32-bit address space, each usually
+ *             allocating a page and a page table
+ *   compare   compare of up to 16 bytes in the working set
+ *   dump      dump of up to 0x40 bytes in the working set
+ *   writable  writable status change of a page aligned range of the working
+ *             set, so later writes to it fault
+ *   quota     quota lowered to just above the pages already used, so the
+ *             next few page allocations terminate the process
+ *
+ * The generator follows the contents of the working set, so compares match
+ * unless an earlier write was refused. Traces are a function of the options
+ * alone (including seed), so the same options give the same trace on every
+ * platform.
+ */
+
+/*
+ * File:   TraceGenerator.h
+ */
+
+#ifndef TRACEGENERATOR_H
+#define TRACEGENERATOR_H
+
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class TraceGenerator {
+public:
+  /**
+   * Options - parameters of a workload (sizes are in bytes)
+   */
+  struct Options {
+    uint32_t seed = 1;
+    long lines = 1000;                // commands after the prologue
+    uint32_t quota = 0x40;            // initial quota, in pages
+    uint32_t base = 0x400000;         // start of working set
+    uint32_t working_set = 0x20000;   // size of working set
+    uint32_t fill_size = 0x1000;      // largest fill
+    uint32_t copy_size = 0x1000;      // largest copy
+    uint32_t sparse_burst = 16;       // puts in a sparse storm
+    // relative frequency of each kind of command
+    int fill_weight = 4;
+    int copy_weight = 2;
+    int put_weight = 4;
+    int sparse_weight = 0;
+    int compare_weight = 2;
+    int dump_weight = 1;
+    int writable_weight = 1;
+    int quota_weight = 0;
+  };
+
+  /**
+   * Constructor
+   *
+   * @param options_ workload parameters (working_set is rounded up to a
+   *   whole number of pages)
+   */
+  TraceGenerator(const Options &options_);
+
+  virtual ~TraceGenerator() {}
+
+  // Disallow copy/move
+  TraceGenerator(const TraceGenerator &other) = delete;
+  TraceGenerator(TraceGenerator &&other) = delete;
+  TraceGenerator &operator=(const TraceGenerator &other) = delete;
+  TraceGenerator &operator=(TraceGenerator &&other) = delete;
+
+  /**
+   * Preset - set the weights of a named workload: mixed (the defaults),
+   *   fill, copy, sparse, quota or writable
+   *
+   * @param name workload name
+   * @param options options to change
+   * @return false if name is not a workload
+   */
+  static bool Preset(const std::string &name, Options &options);
+
+  /**
+   * ParseOption - set a workload parameter from a command line option
+   *   ("--workload name" selects a Preset; see kOptionsUsage)
+   *
+   * @param option option name, including "--"
+   * @param value option value (hexadecimal for sizes and addresses, as in
+   *   traces)
+   * @param options options to change
+   * @return false if option is not a workload option or value is invalid
+   */
+  static bool ParseOption(const std::string &option, const std::string &value,
+                          Options &options);
+
+  // Usage text of the workload options
+  static const char kOptionsUsage[];
+
+  /**
+   * Write - write the whole trace
+   *
+   * @param out destination of trace
+   */
+  void Write(std::ostream &out);
+
+  /**
+   * WriteFile - write the whole trace to a file
+   *
+   * @param file_name trace file to create
+   * @return true if success, false if an error was reported to cerr
+   */
+  bool WriteFile(const std::string &file_name);
+
+private:
+  Options options;
+  std::mt19937 random;
+
+  // Contents and writable status of the working set, and all pages touched
+  std::vector<uint8_t> memory;
+  std::vector<bool> writable;
+  std::unordered_set<uint32_t> pages;
+
+  /**
+   * Random - random number in [0, n), or 0 if n is 0
+   */
+  uint32_t Random(uint32_t n);
+
+  /**
+   * Store - follow a write of count bytes at addr, which stops at the first
+   *   working set page which is not writable
+   */
+  void Store(uint32_t addr, const uint8_t *bytes, uint32_t count);
+
+  /**
+   * Command writers - each writes one or more lines
+   */
+  void WriteFill(std::ostream &out);
+  void WriteCopy(std::ostream &out);
+  void WritePut(std::ostream &out);
+  void WriteSparse(std::ostream &out);
+  void WriteCompare(std::ostream &out);
+  void WriteDump(std::ostream &out);
+  void WriteWritable(std::ostream &out);
+  void WriteQuota(std::ostream &out);
+};
+
+#endif /* TRACEGENERATOR_H */
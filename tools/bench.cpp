@@ -0,0 +1,294 @@
+/*
+ * bench - benchmark the simulator on synthetic or given traces
+ */
+
+/*
+ * File:   bench.cpp
+ */
+
+/*
+ * Runs the Scheduler in-process over a set of traces, discarding the
+ * simulation output, and reports lines per second, faults (page faults
+ * serviced plus read and write faults reported) per second and peak page
+ * frames in use for each run. Unless trace files are given, the traces are
+ * generated (see TraceGenerator.h) into a temporary directory, one per
+ * process, with consecutive seeds.
+ *
+ * With "--results file", each run is appended to file as one JSON object per
+ * line, so results of different commits can be collected in one file and
+ * compared ("--label" names the commit or build).
+ */
+
+#include "OutputSink.h"
+#include "PageFrameAllocator.h"
+#include "PageReplacer.h"
+#include "Scheduler.h"
+#include "SchedulingPolicy.h"
+#include "SimulatorStats.h"
+#include "TraceCompiler.h"
+#include "TraceGenerator.h"
+
+#include <MMU.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+/*
+ * Usage - print command line usage and exit
+ */
+void Usage(const char *program) {
+  std::cerr << "usage: " << program << " [options] [trace_file...]\n"
+            << "options:\n"
+            << "  --processes n     generated traces to run (default 4)\n"
+            << "  --time-slice n    lines per time slice (default 100)\n"
+            << "  --repeat n        runs (default 3)\n"
+            << "  --threads n       run processes on n worker threads\n"
+            << "  --frames n        page frames of physical memory (default 1024)\n"
+            << "  --policy name     scheduling policy (see main)\n"
+            << "  --swap file       page to swap file when frames run out\n"
+            << "  --replacement name  page replacement policy (see main)\n"
+            << "  --prefetch bytes  read traces ahead on a reader thread (see main)\n"
+            << "  --binary          compile generated traces to binary format\n"
+            << "  --results file    append results to file as JSON lines\n"
+            << "  --label text      label of results, such as a commit id\n"
+            << TraceGenerator::kOptionsUsage;
+  exit(1);
+}
+
+/*
+ * JsonString - text as a JSON string
+ */
+std::string JsonString(const std::string &text) {
+  std::string json = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      json += '\\';
+    }
+    json += c;
+  }
+  return json + "\"";
+}
+
+/*
+ * BenchResult - measurements of one run
+ */
+struct BenchResult {
+  uint64_t lines = 0;
+  uint64_t faults = 0;
+  uint64_t wall_ns = 0;
+  uint64_t peak_frames = 0;
+  uint64_t swap_ins = 0;
+  uint64_t swap_outs = 0;
+
+  double LinesPerSecond(void) const {
+    return wall_ns ? lines * 1e9 / wall_ns : 0;
+  }
+  double FaultsPerSecond(void) const {
+    return wall_ns ? faults * 1e9 / wall_ns : 0;
+  }
+};
+
+/*
+ * Run - run the scheduler once over all traces
+ */
+BenchResult Run(std::vector<std::string> &file_names, int time_slice,
+                long frames, const SchedulerOptions &options, int null_fd) {
+  mem::MMU memory(frames);
+  PageFrameAllocator allocator(memory);
+  OutputSink output(null_fd);
+  Scheduler scheduler(file_names, memory, allocator, output, time_slice,
+                      options);
+  scheduler.Execute();
+
+  SchedulerStats scheduler_stats;
+  AllocatorStats allocator_stats;
+  const std::vector<ProcessStats> &processes =
+          scheduler.GetStats(scheduler_stats, allocator_stats);
+  BenchResult result;
+  for (const ProcessStats &p : processes) {
+    result.lines += p.TotalLines();
+    result.faults += p.page_faults + p.read_faults + p.write_faults;
+    result.swap_ins += p.swap_ins;
+    result.swap_outs += p.swap_outs;
+  }
+  result.wall_ns = scheduler_stats.wall_ns;
+  result.peak_frames = allocator_stats.peak_frames_in_use;
+  return result;
+}
+}
+
+int main(int argc, char* argv[]) {
+  TraceGenerator::Options workload;
+  std::string workload_name = "mixed";
+  SchedulerOptions options;
+  int processes = 4;
+  int time_slice = 100;
+  int repeat = 3;
+  long frames = 1024;
+  bool binary = false;
+  std::string results_file;
+  std::string label;
+  int arg = 1;
+  while (arg < argc && std::string(argv[arg]).compare(0, 2, "--") == 0) {
+    std::string option = argv[arg++];
+    if (option == "--binary") {
+      binary = true;
+      continue;
+    }
+    if (arg >= argc) {
+      Usage(argv[0]);
+    }
+    std::string value = argv[arg++];
+    if (option == "--processes") {
+      processes = std::atoi(value.c_str());
+    } else if (option == "--time-slice") {
+      time_slice = std::atoi(value.c_str());
+    } else if (option == "--repeat") {
+      repeat = std::atoi(value.c_str());
+    } else if (option == "--frames") {
+      frames = std::atol(value.c_str());
+    } else if (option == "--threads") {
+      options.threads = std::atoi(value.c_str());
+    } else if (option == "--policy") {
+      options.policy = value;
+      if (!SchedulingPolicy::Create(options.policy, 1)) {
+        Usage(argv[0]);
+      }
+    } else if (option == "--swap") {
+      options.swap_file = value;
+    } else if (option == "--replacement") {
+      options.replacement = value;
+      PageReplacer::Policy replacement;
+      if (!PageReplacer::PolicyFromName(options.replacement, replacement)) {
+        Usage(argv[0]);
+      }
+    } else if (option == "--prefetch") {
+      options.prefetch_depth = std::atol(value.c_str());
+    } else if (option == "--results") {
+      results_file = value;
+    } else if (option == "--label") {
+      label = value;
+    } else if (TraceGenerator::ParseOption(option, value, workload)) {
+      if (option == "--workload") {
+        workload_name = value;
+      }
+    } else {
+      Usage(argv[0]);
+    }
+  }
+  if (processes < 1 || time_slice < 1 || repeat < 1 || options.threads < 1
+      || frames < 1 || frames > 0x100000) {
+    Usage(argv[0]);
+  }
+
+  // Generate the traces unless given
+  std::vector<std::string> file_names(argv + arg, argv + argc);
+  std::string trace_dir;
+  if (file_names.empty()) {
+    char dir_template[] = "/tmp/bench.XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+      std::cerr << "ERROR: failed to create trace directory\n";
+      exit(2);
+    }
+    trace_dir = dir_template;
+    TraceGenerator::Options trace_workload = workload;
+    for (int i = 0; i < processes; ++i) {
+      std::string text_name = trace_dir + "/trace" + std::to_string(i) + ".txt";
+      TraceGenerator generator(trace_workload);
+      if (!generator.WriteFile(text_name)) {
+        exit(2);
+      }
+      ++trace_workload.seed;
+      if (binary) {
+        std::string binary_name = trace_dir + "/trace" + std::to_string(i)
+                                  + ".bin";
+        TraceCompiler compiler(text_name, binary_name);
+        if (!compiler.Compile()) {
+          exit(2);
+        }
+        file_names.push_back(binary_name);
+      } else {
+        file_names.push_back(text_name);
+      }
+    }
+  } else {
+    workload_name = "files";
+  }
+
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd < 0) {
+    std::cerr << "ERROR: failed to open /dev/null\n";
+    exit(2);
+  }
+  std::ofstream results;
+  if (!results_file.empty()) {
+    results.open(results_file, std::ios_base::out | std::ios_base::app);
+    if (!results.is_open()) {
+      std::cerr << "ERROR: failed to open results file: " << results_file
+                << "\n";
+      exit(2);
+    }
+  }
+
+  std::cout << std::fixed << std::setprecision(0);
+  for (int run = 1; run <= repeat; ++run) {
+    BenchResult result = Run(file_names, time_slice, frames, options, null_fd);
+    std::cout << "run " << run << ": " << result.lines << " lines, "
+              << result.faults << " faults in "
+              << std::setprecision(3) << result.wall_ns / 1e6 << " ms; "
+              << std::setprecision(0) << result.LinesPerSecond()
+              << " lines/s, " << result.FaultsPerSecond() << " faults/s, "
+              << "peak " << result.peak_frames << " frames, "
+              << result.swap_ins << " swap ins, " << result.swap_outs
+              << " swap outs\n";
+    if (results.is_open()) {
+      std::ostringstream json;
+      json << std::fixed << std::setprecision(1)
+           << "{\"label\": " << JsonString(label)
+           << ", \"workload\": " << JsonString(workload_name)
+           << ", \"seed\": " << workload.seed
+           << ", \"trace_lines\": " << workload.lines
+           << ", \"processes\": " << file_names.size()
+           << ", \"threads\": " << options.threads
+           << ", \"frames\": " << frames
+           << ", \"policy\": " << JsonString(options.policy)
+           << ", \"replacement\": " << JsonString(options.swap_file.empty()
+                                                  ? "none" : options.replacement)
+           << ", \"time_slice\": " << time_slice
+           << ", \"binary\": " << (binary ? "true" : "false")
+           << ", \"run\": " << run
+           << ", \"lines\": " << result.lines
+           << ", \"faults\": " << result.faults
+           << ", \"wall_ns\": " << result.wall_ns
+           << ", \"lines_per_sec\": " << result.LinesPerSecond()
+           << ", \"faults_per_sec\": " << result.FaultsPerSecond()
+           << ", \"peak_frames\": " << result.peak_frames
+           << ", \"swap_ins\": " << result.swap_ins
+           << ", \"swap_outs\": " << result.swap_outs << "}\n";
+      results << json.str();
+    }
+  }
+  close(null_fd);
+
+  if (!trace_dir.empty()) {
+    for (const std::string &name : file_names) {
+      std::remove(name.c_str());
+      if (binary) {
+        std::string text_name = name.substr(0, name.size() - 4) + ".txt";
+        std::remove(text_name.c_str());
+      }
+    }
+    rmdir(trace_dir.c_str());
+  }
+  return 0;
+}
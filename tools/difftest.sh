@@ -0,0 +1,116 @@
+#!/bin/bash
+#
+# difftest - differential tests of the simulator: runs generated traces (and
+# a few written here) serially from the text traces, then with each feature
+# which must not change the output, and compares the outputs:
+#   - compiled binary traces (--compile)
+#   - parallel workers (--threads, in order)
+#   - page sharing (--dedup), huge pages, prefetching, trace mapping limits
+#   - paging to swap in a small memory (--swap)
+#   - checkpoints: a checkpointing run writes the whole output, and a run
+#     restored from the checkpoint writes the rest of it
+# and that a run out of memory fails the same way with threads.
+#
+# usage: difftest.sh main tracegen
+# Exits 1 if any output differs, after reporting every difference.
+#
+
+if [ $# -ne 2 ]; then
+  echo "usage: $0 main tracegen" >&2
+  exit 2
+fi
+SIM=$1
+TRACEGEN=$2
+DIR=$(mktemp -d) || exit 2
+trap 'rm -rf "$DIR"' EXIT
+FAILED=0
+
+# Traces: two of each generated workload, and traces of the cases --compile
+# encodes specially (compare values wider than a byte, comments, errors)
+for workload in mixed fill copy sparse quota writable; do
+  "$TRACEGEN" --workload $workload --lines 400 --seed 7 \
+      "$DIR/$workload.1.txt" "$DIR/$workload.2.txt" || exit 2
+done
+cat > "$DIR/wide.txt" <<EOF
+# compare values which don't fit in a byte
+quota 10
+put 1000 1 2 3 4 5 6 7 8
+compare 1000 1 102 3
+compare 1003 4 5 106 7 fff
+compare 1000 101 2 3 4
+dump 1000 8
+writable 1000 1000 0
+put 1000 9
+EOF
+cat > "$DIR/quota.txt" <<EOF
+quota 2
+fill 0 3000 1
+EOF
+TRACES=$(ls "$DIR"/*.txt)
+for t in $TRACES; do
+  if ! "$SIM" --compile "$t" "${t%.txt}.bin"; then
+    echo "FAIL: --compile $(basename "$t")"
+    exit 1
+  fi
+done
+BINARY=$(ls "$DIR"/*.bin)
+
+# check name expected actual: report a difference
+check() {
+  if ! cmp -s "$2" "$3"; then
+    echo "FAIL: $1"
+    FAILED=1
+  fi
+}
+
+# run file args...: run the simulator, writing output and exit status
+run() {
+  local out=$1
+  shift
+  "$SIM" "$@" > "$out" 2>&1
+  echo "exit $?" >> "$out"
+}
+
+for slice in 1 7 50; do
+  run "$DIR/serial" --frames 8192 $slice $TRACES
+  run "$DIR/out" --frames 8192 $slice $BINARY
+  check "binary traces, time slice $slice" "$DIR/serial" "$DIR/out"
+  for threads in 2 4; do
+    run "$DIR/out" --frames 8192 --threads $threads $slice $TRACES
+    check "--threads $threads, time slice $slice" "$DIR/serial" "$DIR/out"
+  done
+  for option in --dedup --huge-pages "--prefetch 4096" \
+                "--max-mapped-traces 3"; do
+    run "$DIR/out" --frames 8192 $option $slice $TRACES
+    check "$option, time slice $slice" "$DIR/serial" "$DIR/out"
+  done
+  run "$DIR/out" --frames 256 --swap "$DIR/swap" $slice $TRACES
+  check "--swap, time slice $slice" "$DIR/serial" "$DIR/out"
+  run "$DIR/out" --frames 256 --swap "$DIR/swap" --threads 2 $slice $TRACES
+  check "--swap --threads 2, time slice $slice" "$DIR/serial" "$DIR/out"
+
+  # A restored run writes what the full run wrote after the checkpoint
+  for at in 1 100 1000; do
+    run "$DIR/out" --frames 8192 --checkpoint "$DIR/checkpoint" \
+        --checkpoint-at $at $slice $TRACES
+    check "--checkpoint-at $at, time slice $slice" "$DIR/serial" "$DIR/out"
+    run "$DIR/out" --frames 8192 --restore "$DIR/checkpoint" $slice $TRACES
+    size=$(stat -c %s "$DIR/out")
+    tail -c $size "$DIR/serial" > "$DIR/rest"
+    check "--restore at $at, time slice $slice" "$DIR/rest" "$DIR/out"
+  done
+done
+
+# Threads split memory rather than adding to it: a run which runs out of
+# page frames serially also does with threads (the output up to the error
+# may differ, so only the exit status is compared)
+printf 'quota 40\nfill 0 28000 1\n' > "$DIR/large"
+run "$DIR/serial" --frames 64 1 "$DIR/large" "$DIR/large"
+run "$DIR/out" --frames 64 --threads 2 1 "$DIR/large" "$DIR/large"
+check "exit status out of page frames with --threads 2" \
+    <(tail -n 1 "$DIR/serial") <(tail -n 1 "$DIR/out")
+
+if [ $FAILED -eq 0 ]; then
+  echo "difftest: all outputs match"
+fi
+exit $FAILED
@@ -0,0 +1,54 @@
+/*
+ * tracegen - write synthetic memory traces (see TraceGenerator.h)
+ */
+
+/*
+ * File:   tracegen.cpp
+ */
+
+/*
+ * The command line arguments are workload options followed by the names of
+ * the trace files to write. Each file gets a different trace: the seed is
+ * incremented for each file after the first.
+ */
+
+#include "TraceGenerator.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+/*
+ * Usage - print command line usage and exit
+ */
+void Usage(const char *program) {
+  std::cerr << "usage: " << program << " [options] trace_file...\n"
+            << TraceGenerator::kOptionsUsage;
+  exit(1);
+}
+}
+
+int main(int argc, char* argv[]) {
+  TraceGenerator::Options options;
+  int arg = 1;
+  while (arg < argc && std::string(argv[arg]).compare(0, 2, "--") == 0) {
+    std::string option = argv[arg++];
+    if (arg >= argc || !TraceGenerator::ParseOption(option, argv[arg++],
+                                                    options)) {
+      Usage(argv[0]);
+    }
+  }
+  if (arg >= argc) {
+    Usage(argv[0]);
+  }
+
+  for (; arg < argc; ++arg) {
+    TraceGenerator generator(options);
+    if (!generator.WriteFile(argv[arg])) {
+      return 2;
+    }
+    ++options.seed;
+  }
+  return 0;
+}